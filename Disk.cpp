@@ -8,15 +8,37 @@
 #include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <time.h>
 
 #include "Disk.h"
 #include "dthread.h"
+#include "Trace.h"
 
 using namespace std;
 
+static unsigned long long now_micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 Disk::Disk(string imageFile, int blockSize) {
   this->imageFile = imageFile;
   this->blockSize = blockSize;
+  this->isInTransaction = false;
+  this->rollbackCount = 0;
+  this->hasLayout = false;
+  for (int op = 0; op < DISK_OPS; op++) {
+    for (int region = 0; region < DISK_REGIONS; region++) {
+      this->ops[op][region] = 0;
+      this->bytes[op][region] = 0;
+      this->micros[op][region] = 0;
+      for (int bucket = 0; bucket < DISK_LATENCY_BUCKETS; bucket++) {
+	this->latency[op][region][bucket] = 0;
+      }
+    }
+  }
+  this->undoRecords = 0;
 
   struct stat stat;
   int imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
@@ -48,6 +70,8 @@ int Disk::numberOfBlocks() {
 }
 
 void Disk::readBlock(int blockNumber, void *buffer) {
+  TraceSpan span(TRACE_BLOCK_READ, blockNumber);
+  unsigned long long start = now_micros();
   if (blockNumber < 0 || blockNumber > this->numberOfBlocks()) {
     cerr << "Invalid block number " << blockNumber << endl;
     exit(1);
@@ -72,24 +96,32 @@ void Disk::readBlock(int blockNumber, void *buffer) {
     cerr << "Could not read file" << endl;
     exit(1);
   }
+  record(DISK_READ, blockNumber, this->blockSize, now_micros() - start);
 
   close(fd);
 }
 
-void Disk::writeBlock(int blockNumber, void *buffer) {  
-  if (blockNumber < 0 || blockNumber > this->numberOfBlocks()) {
-    cerr << "Invalid block number " << blockNumber << endl;
-    exit(1);
-  }
-
+void Disk::writeBlock(int blockNumber, void *buffer) {
   if (isInTransaction) {
     struct UndoRecord undoRecord;
     undoRecord.blockNumber = blockNumber;
     undoRecord.blockData = new unsigned char[blockSize];
     this->readBlock(blockNumber, undoRecord.blockData);
     undoLog.push_front(undoRecord);
+    undoRecords++;
   }
-  
+
+  writeNewBlock(blockNumber, buffer);
+}
+
+void Disk::writeNewBlock(int blockNumber, void *buffer) {
+  TraceSpan span(TRACE_BLOCK_WRITE, blockNumber);
+  if (blockNumber < 0 || blockNumber > this->numberOfBlocks()) {
+    cerr << "Invalid block number " << blockNumber << endl;
+    exit(1);
+  }
+
+  unsigned long long start = now_micros();
   int fd = open(this->imageFile.c_str(), O_RDWR);
   if (fd < 0) {
     cerr << "Could not open image file " << this->imageFile << endl;
@@ -109,7 +141,13 @@ void Disk::writeBlock(int blockNumber, void *buffer) {
     cerr << "Could not write file" << endl;
     exit(1);
   }
-  fsync(fd);
+  unsigned long long synced = now_micros();
+  record(DISK_WRITE, blockNumber, this->blockSize, synced - start);
+  {
+    TraceSpan sync(TRACE_FSYNC, blockNumber);
+    fsync(fd);
+  }
+  record(DISK_FSYNC, blockNumber, 0, now_micros() - synced);
   close(fd);
 }
 
@@ -122,6 +160,7 @@ void Disk::beginTransaction() {
 }
 
 void Disk::commit() {
+  TraceSpan span(TRACE_COMMIT);
   isInTransaction = false;
   deque<struct UndoRecord>::iterator iter;
   for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
@@ -131,7 +170,9 @@ void Disk::commit() {
 }
 
 void Disk::rollback() {
+  TraceSpan span(TRACE_ROLLBACK);
   isInTransaction = false;
+  rollbackCount++;
   deque<struct UndoRecord>::iterator iter;
   for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
     this->writeBlock(iter->blockNumber, iter->blockData);
@@ -139,3 +180,75 @@ void Disk::rollback() {
   }
   undoLog.clear();
 }
+
+void Disk::setLayout(const super_t &super) {
+  this->layout = super;
+  this->hasLayout = true;
+}
+
+DiskRegion Disk::regionOf(int blockNumber) {
+  if (blockNumber == 0) {
+    return DISK_SUPERBLOCK;
+  }
+  if (!hasLayout) {
+    return DISK_DATA;
+  }
+  if (blockNumber >= layout.inode_bitmap_addr && blockNumber < layout.inode_bitmap_addr + layout.inode_bitmap_len) {
+    return DISK_INODE_BITMAP;
+  }
+  if (blockNumber >= layout.data_bitmap_addr && blockNumber < layout.data_bitmap_addr + layout.data_bitmap_len) {
+    return DISK_DATA_BITMAP;
+  }
+  if (blockNumber >= layout.inode_region_addr && blockNumber < layout.inode_region_addr + layout.inode_region_len) {
+    return DISK_INODE_TABLE;
+  }
+  return DISK_DATA;
+}
+
+void Disk::record(DiskOp op, int blockNumber, int size, unsigned long long elapsed) {
+  DiskRegion region = regionOf(blockNumber);
+  int bucket = 0;
+  while (bucket < DISK_LATENCY_BUCKETS - 1 && elapsed >= (1ULL << bucket)) {
+    bucket++;
+  }
+  ops[op][region].fetch_add(1, memory_order_relaxed);
+  bytes[op][region].fetch_add(size, memory_order_relaxed);
+  micros[op][region].fetch_add(elapsed, memory_order_relaxed);
+  latency[op][region][bucket].fetch_add(1, memory_order_relaxed);
+}
+
+void Disk::stats(DiskStats *stats) {
+  for (int op = 0; op < DISK_OPS; op++) {
+    for (int region = 0; region < DISK_REGIONS; region++) {
+      stats->ops[op][region] = ops[op][region].load(memory_order_relaxed);
+      stats->bytes[op][region] = bytes[op][region].load(memory_order_relaxed);
+      stats->micros[op][region] = micros[op][region].load(memory_order_relaxed);
+      for (int bucket = 0; bucket < DISK_LATENCY_BUCKETS; bucket++) {
+	stats->latency[op][region][bucket] = latency[op][region][bucket].load(memory_order_relaxed);
+      }
+    }
+  }
+  stats->undoRecords = undoRecords.load(memory_order_relaxed);
+}
+
+unsigned long DiskStats::total(DiskOp op) const {
+  unsigned long sum = 0;
+  for (int region = 0; region < DISK_REGIONS; region++) {
+    sum += ops[op][region];
+  }
+  return sum;
+}
+
+const char *DiskStats::opName(int op) {
+  static const char *names[DISK_OPS] = { "read", "write", "fsync" };
+  return names[op];
+}
+
+const char *DiskStats::regionName(int region) {
+  static const char *names[DISK_REGIONS] = { "superblock", "inode_bitmap", "data_bitmap", "inode_table", "data" };
+  return names[region];
+}
+
+double DiskStats::bucketBound(int bucket) {
+  return bucket < DISK_LATENCY_BUCKETS - 1 ? (1ULL << bucket) / 1000000.0 : 0;
+}
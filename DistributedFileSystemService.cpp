@@ -2,17 +2,22 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sstream>
 #include <iostream>
 #include <map>
 #include <string>
 #include <algorithm>
 #include <cstring>
+#include <memory>
+#include <atomic>
 
 #include "DistributedFileSystemService.h"
 #include "ClientError.h"
 #include "ufs.h"
 #include "WwwFormEncodedDict.h"
+#include "HttpUtils.h"
+#include "StringUtils.h"
 
 using namespace std;
 
@@ -21,9 +26,205 @@ bool compareEntries(const pair<string, bool>& a, const pair<string, bool>& b) {
     return a.first < b.first;
 }
 
+// Separator for multipart/byteranges bodies, it only has to be unlikely to show up in the file
+static string byteRangesBoundary() {
+    static atomic<unsigned long long> counter(0);
+    char boundary[64]; snprintf(boundary, sizeof(boundary), "ds3-%lx-%llx", (unsigned long)time(NULL), ++counter);
+    return boundary;
+}
+
+// Holds the file system lock until it goes out of scope, shared by readers and exclusive for writers
+class FileSystemLock {
+public:
+    FileSystemLock(pthread_rwlock_t *lock, bool exclusive) : lock(lock) {
+        if (exclusive) { pthread_rwlock_wrlock(lock); } else { pthread_rwlock_rdlock(lock); }
+    }
+    ~FileSystemLock() { pthread_rwlock_unlock(lock); }
+
+private:
+    pthread_rwlock_t *lock;
+};
+
+// Collects a chunked request body in memory, its size has to be known before it can be staged. It stops
+// keeping bytes one past MAX_FILE_SIZE, which is enough to tell the body is too big
+class BufferSink : public HttpBodySink {
+public:
+    void onBody(const char *data, size_t length) { body.append(data, min(length, (size_t)MAX_FILE_SIZE + 1 - min(body.size(), (size_t)MAX_FILE_SIZE + 1))); }
+    string body;
+};
+
+// Writes a PUT body into blocks staged for it as it arrives, see LocalFileSystem::stageWrite. Only staging
+// the blocks and giving them back take the lock, a write that is never committed gives them back when it goes away
+class StagedWriteSink : public HttpBodySink {
+public:
+    StagedWriteSink(LocalFileSystem *fileSystem, pthread_rwlock_t *fileSystemLock) :
+        fileSystem(fileSystem), fileSystemLock(fileSystemLock), failed(false), committed(false) {}
+
+    ~StagedWriteSink() {
+        if (committed || stream.staged.empty()) { return; }
+        FileSystemLock lock(fileSystemLock, true);
+        fileSystem->disk->beginTransaction(); fileSystem->abortWrite(&stream); fileSystem->disk->commit();
+    }
+
+    int stage(int size) {
+        FileSystemLock lock(fileSystemLock, true);
+        fileSystem->disk->beginTransaction(); int EVALUE = fileSystem->stageWrite(size, &stream);
+        if (EVALUE < 0) { fileSystem->disk->rollback(); } else { fileSystem->disk->commit(); }
+        return EVALUE;
+    }
+
+    void onBody(const char *data, size_t length) { if (!failed && fileSystem->appendWrite(&stream, data, length) < 0) { failed = true; } }
+
+    LocalFileSystem *fileSystem; pthread_rwlock_t *fileSystemLock; WriteStream stream; bool failed, committed;
+};
+
+// A file's response body as a list of parts, each some literal text followed by a range of the file,
+// so a whole file, a single range and a multipart/byteranges body are all produced the same way.
+// The body goes out after get() has let go of the lock, so each read() takes the shared lock again
+// for about a block and fails if the file has been replaced or removed since it was looked up
+class FileReadSource : public HttpBodySource {
+public:
+    struct Part { string text; int offset; int length; };
+
+    FileReadSource(LocalFileSystem *fileSystem, pthread_rwlock_t *fileSystemLock, int inodeNumber, const inode_t &inode) :
+        fileSystem(fileSystem), fileSystemLock(fileSystemLock), inodeNumber(inodeNumber), generation(fileSystem->generation(inodeNumber)),
+        inode(inode), current(0), position(0) {}
+
+    void addPart(string text, int offset, int length) { Part p = { text, offset, length }; parts.push_back(p); }
+
+    size_t length() {
+        size_t total = 0; for (const auto& p : parts) { total += p.text.size() + p.length; }
+        return total;
+    }
+
+    int read(void *buffer, int size) {
+        FileSystemLock lock(fileSystemLock, false);
+        if (fileSystem->generation(inodeNumber) != generation) { return -EINVALIDSIZE; }
+
+        // Text first, then the part's range of the file, then on to the next part
+        char *out = (char *)buffer; int filled = 0;
+        while (filled < size && current < parts.size()) {
+            const Part &p = parts[current]; int textSize = p.text.size(), n;
+            if (position < textSize) { n = min(size - filled, textSize - position); memcpy(out + filled, p.text.data() + position, n); }
+            else {
+                n = min(size - filled, textSize + p.length - position);
+                if (n > 0 && fileSystem->readAt(&inode, p.offset + position - textSize, out + filled, n) != n) { return -EINVALIDSIZE; }
+            }
+            filled += n; position += n;
+            if (position == textSize + p.length) { current++; position = 0; }
+        }
+        return filled;
+    }
+
+private:
+    LocalFileSystem *fileSystem; pthread_rwlock_t *fileSystemLock; int inodeNumber; unsigned long long generation;
+    inode_t inode; vector<Part> parts; size_t current; int position;
+};
+
 // Constructor for DistributedFileSystemService
-DistributedFileSystemService::DistributedFileSystemService(string diskFile) : HttpService("/ds3/") {
+DistributedFileSystemService::DistributedFileSystemService(string diskFile, bool deduplicate) : HttpService("/ds3/") {
     this->fileSystem = new LocalFileSystem(new Disk(diskFile, UFS_BLOCK_SIZE));
+    this->fileSystem->setDeduplicate(deduplicate);
+    this->startTime = time(NULL);
+
+    // Prefer writers so a steady stream of GETs can't hold off PUTs and DELETEs forever
+    pthread_rwlockattr_t attributes; pthread_rwlockattr_init(&attributes);
+#ifdef __linux__
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&this->lock, &attributes); pthread_rwlockattr_destroy(&attributes);
+}
+
+// Generations only live in memory, so the start time keeps tags from before a restart from matching
+string DistributedFileSystemService::etag(int inodeNumber) {
+    char tag[64]; snprintf(tag, sizeof(tag), "\"%lx-%d-%llx\"", (unsigned long)startTime, inodeNumber, fileSystem->generation(inodeNumber));
+    return tag;
+}
+
+static int countFree(const vector<unsigned char> &bitmap, int entries) {
+    int free = 0;
+    for (int i = 0; i < entries; i++) { if ((bitmap[i / 8] & (1 << (i % 8))) == 0) { free++; } }
+    return free;
+}
+
+void DistributedFileSystemService::usage(FileSystemUsage *usage) {
+    FileSystemLock lock(&this->lock, false);
+
+    super_t super; this->fileSystem->readSuperBlock(&super);
+    vector<unsigned char> inodeBitmap(super.inode_bitmap_len * UFS_BLOCK_SIZE);
+    vector<unsigned char> dataBitmap(super.data_bitmap_len * UFS_BLOCK_SIZE);
+    this->fileSystem->readInodeBitmap(&super, inodeBitmap.data());
+    this->fileSystem->readDataBitmap(&super, dataBitmap.data());
+
+    usage->inodes = super.num_inodes; usage->freeInodes = countFree(inodeBitmap, super.num_inodes);
+    usage->dataBlocks = super.num_data; usage->freeDataBlocks = countFree(dataBitmap, super.num_data);
+    this->fileSystem->disk->stats(&usage->disk);
+}
+
+// Paths that change the file system have to name every directory on the way, a . or .. could otherwise
+// walk into /ds3/.snapshots without its name being the first component
+static void checkComponents(const vector<string> &components) {
+    for (const auto& component : components) {
+        if (component.empty() || component == "." || component == "..") { throw ClientError::badRequest(); }
+    }
+}
+
+// Snapshots are read-only, so nothing under /ds3/.snapshots can be written, deleted or moved
+static bool inSnapshots(const vector<string> &components) {
+    return !components.empty() && components[0] == SNAPSHOT_DIRECTORY;
+}
+
+// Walks every component but the last from the root, creating directories that don't exist yet, and returns the
+// inode number of the last one. Must be called inside a transaction, holding the lock exclusively
+int DistributedFileSystemService::makeDirectories(const vector<string> &components) {
+    int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    for (size_t i = 0; i + 1 < components.size(); ++i) {
+
+        // Get the Inode Number of the Component
+        int entryInodeNumber = this->fileSystem->lookup(inodeNumber, components[i]);
+
+        // If the Inode Does Not Exist, then Create it
+        if (entryInodeNumber < 0) {
+            entryInodeNumber = this->fileSystem->create(inodeNumber, UFS_DIRECTORY, components[i]);
+            if (entryInodeNumber < 0) { throw ClientError::badRequest(); }
+        }
+
+        // Otherwise Check if the Existing Inode is Valid
+        else {
+            inode_t entryInode;
+            int statResult = this->fileSystem->stat(entryInodeNumber, &entryInode);
+            if (statResult < 0 || entryInode.type != UFS_DIRECTORY) { throw ClientError::conflict(); }
+        }
+
+        // Set the current Inode Number to the Entry Inode Number to Continue Recursion
+        inodeNumber = entryInodeNumber;
+    }
+    return inodeNumber;
+}
+
+// Splits the Destination header of a MOVE or COPY into components below /ds3. It may be a path (/ds3/x/y)
+// or a full URL, whose scheme, host and query string are ignored
+vector<string> DistributedFileSystemService::destination(HTTPRequest *request) {
+    if (!request->hasHeader("Destination")) { throw ClientError::badRequest(); }
+
+    string destination = request->getHeader("Destination");
+    size_t scheme = destination.find("://");
+    if (scheme != string::npos) { size_t path = destination.find('/', scheme + 3); destination = path == string::npos ? "/" : destination.substr(path); }
+    destination = destination.substr(0, destination.find('?'));
+    vector<string> target = StringUtils::split(destination, '/');
+    if (target.size() < 2 || target[0] != "ds3") { throw ClientError::badRequest(); }
+
+    target.erase(target.begin()); checkComponents(target); return target;
+}
+
+void DistributedFileSystemService::head(HTTPRequest *request, HTTPResponse *response) {
+
+    /*
+     HEAD returns the same headers as GET, including Content-Length, type and ETag, without a body.
+     GET skips reading the file's blocks for a HEAD, so for a file this is just a path lookup and a stat.
+     */
+
+    get(request, response); response->withoutBody();
 }
 
 void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *response) {
@@ -54,6 +255,9 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
     // Initialize the inode to the root directory inode number
     int inode = UFS_ROOT_DIRECTORY_INODE_NUMBER;
 
+    // Other GETs can run alongside this one, but no PUT or DELETE
+    FileSystemLock lock(&this->lock, false);
+
     // Recursively search for the inode number of the desired file/entry
     for (size_t i = 0; i < components.size(); ++i) {
         inode = fileSystem->lookup(inode, components[i]);
@@ -61,27 +265,67 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
     }
 
     // Retrieve the inode data using the inode number
-    inode_t entryInode; fileSystem->stat(inode, &entryInode);
-
-    // Allocate buffer to read the inode data
-    char* buffer = new char[entryInode.size];
-    int bytesRead = fileSystem->read(inode, buffer, entryInode.size);
-    if (bytesRead < 0) { throw ClientError::notFound(); }
+    inode_t entryInode; if (fileSystem->stat(inode, &entryInode) < 0) { throw ClientError::notFound(); }
 
+    int status = 200;
     switch (entryInode.type) {
             
-        // If the entry is a file, then print out its contents
-        case UFS_REGULAR_FILE: { response->setBody(string(buffer, bytesRead)); break; }
+        // If the entry is a file, send its contents or the ranges of them that were asked for
+        case UFS_REGULAR_FILE: {
+
+            // Answer conditional requests from the tag alone, before touching any data blocks
+            string tag = etag(inode); response->setHeader("ETag", tag); response->setHeader("X-DS3-Type", "file");
+            if (request->hasHeader("If-Match") && !HttpUtils::strongEtagMatches(request->getHeader("If-Match"), tag)) { throw ClientError::preconditionFailed(); }
+            if (request->hasHeader("If-None-Match") && HttpUtils::etagMatches(request->getHeader("If-None-Match"), tag)) { response->setStatus(304); return; }
+
+            shared_ptr<FileReadSource> source = make_shared<FileReadSource>(fileSystem, &this->lock, inode, entryInode);
+            response->setHeader("Accept-Ranges", "bytes");
+
+            // Without a usable Range header send the whole file
+            vector<pair<int64_t, int64_t>> ranges;
+            if (!request->hasHeader("Range") || !HttpUtils::parseRange(request->getHeader("Range"), entryInode.size, &ranges) || ranges.size() > RANGE_MAX_PARTS) {
+                source->addPart("", 0, entryInode.size);
+            }
+
+            // If none of the ranges overlap the file, say how big it actually is
+            else if (ranges.empty()) {
+                response->setHeader("Content-Range", "bytes */" + to_string(entryInode.size));
+                throw ClientError::rangeNotSatisfiable();
+            }
+
+            // A single range is sent as is, several as a multipart/byteranges body
+            else {
+                string boundary = byteRangesBoundary();
+                if (ranges.size() > 1) { response->setContentType("multipart/byteranges; boundary=" + boundary); }
+                for (size_t i = 0; i < ranges.size(); ++i) {
+                    string contentRange = "bytes " + to_string(ranges[i].first) + "-" + to_string(ranges[i].second) + "/" + to_string(entryInode.size);
+                    int offset = ranges[i].first, length = ranges[i].second - ranges[i].first + 1;
+                    if (ranges.size() == 1) { response->setHeader("Content-Range", contentRange); source->addPart("", offset, length); }
+                    else { source->addPart((i == 0 ? "--" : "\r\n--") + boundary + "\r\nContent-Range: " + contentRange + "\r\n\r\n", offset, length); }
+                }
+                if (ranges.size() > 1) { source->addPart("\r\n--" + boundary + "--\r\n", 0, 0); }
+                status = 206;
+            }
+
+            // The file is read a block at a time as the response goes out
+            response->setBodySource(source, source->length()); break;
+        }
 
         // If the entry is a directory, list its contents
         case UFS_DIRECTORY: {
+            response->setHeader("X-DS3-Type", "directory");
+
+            // Read the directory entries into a buffer
+            vector<char> buffer(entryInode.size);
+            int bytesRead = fileSystem->readAt(&entryInode, 0, buffer.data(), entryInode.size);
+            if (bytesRead < 0) { throw ClientError::notFound(); }
 
             // Parse the buffer content into entries
             vector<pair<string, bool>> entries;
-            for (int i = 0; i < (entryInode.size / sizeof(dir_ent_t)); ++i) {
+            for (size_t i = 0; i < bytesRead / sizeof(dir_ent_t); ++i) {
                 
                 // Copy the entry from the buffer into a local variable
-                dir_ent_t entry; memcpy(&entry, buffer + i * sizeof(dir_ent_t), sizeof(dir_ent_t));
+                dir_ent_t entry; memcpy(&entry, buffer.data() + i * sizeof(dir_ent_t), sizeof(dir_ent_t));
                 
                 // Get the entry inode using the entry inode number
                 inode_t entryInode; fileSystem->stat(entry.inum, &entryInode);
@@ -106,8 +350,8 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
             
     }
 
-    // Clean up allocated buffer, and send the response to the client
-    delete[] buffer; response->setStatus(200); return;
+    // Send the response to the client
+    response->setStatus(status); return;
 }
 
 void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *response) {
@@ -129,53 +373,61 @@ void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *respo
     if (components.empty() || components[0] != "ds3") { throw ClientError::notFound(); }
     
     // Remove the first element of the components (ds3)
-    components.erase(components.begin());
+    components.erase(components.begin()); checkComponents(components);
+    if (inSnapshots(components)) { throw ClientError::forbidden(); }
+
+    // Write the body into blocks of its own as it arrives, so a slow client only holds up its own request. Files
+    // are at most MAX_FILE_SIZE bytes, anything announced as bigger is refused without reading it. A chunked body
+    // doesn't say how big it is, so it is read in first and staged once it is all here
+    int64_t contentLength = request->getContentLength();
+    if (contentLength > MAX_FILE_SIZE) { throw ClientError::insufficientStorage(); }
+    StagedWriteSink staged(this->fileSystem, &this->lock);
+    if (contentLength >= 0) {
+        if (staged.stage(contentLength) < 0) { throw ClientError::insufficientStorage(); }
+        request->readBody(&staged);
+    } else {
+        BufferSink sink; request->readBody(&sink);
+        if (sink.body.size() > MAX_FILE_SIZE || staged.stage(sink.body.size()) < 0) { throw ClientError::insufficientStorage(); }
+        staged.onBody(sink.body.data(), sink.body.size());
+    }
+    if (staged.failed) { throw ClientError::badRequest(); }
 
     // Initialize the inode to the root directory inode number
     int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
 
-    // Begin a transaction on the disk before making any changes to the file system
+    // Begin a transaction on the disk before making any changes to the file system, with everyone else locked out
+    FileSystemLock lock(&this->lock, true);
     this->fileSystem->disk->beginTransaction();
 
     try {
-        // Recursively search for the inode number of the desired directory/file
-        for (size_t i = 0; i < components.size() - 1; ++i) {
-            
-            // Get the Inode Number of the Component
-            int entryInodeNumber = this->fileSystem->lookup(inodeNumber, components[i]);
-            
-            // If the Inode Does Not Exist, then Create it
-            if (entryInodeNumber < 0) {
-                entryInodeNumber = this->fileSystem->create(inodeNumber, UFS_DIRECTORY, components[i]);
-                if (entryInodeNumber < 0) { throw ClientError::badRequest(); }
-            }
-            
-            // Otherwise Check if the Existing Inode is Valid
-            else {
-                inode_t entryInode;
-                int statResult = this->fileSystem->stat(entryInodeNumber, &entryInode);
-                if (statResult < 0 || entryInode.type != UFS_DIRECTORY) { throw ClientError::conflict(); }
-            }
-            
-            // Set the current Inode Number to the Entry Inode Number to Continue Recursion
-            inodeNumber = entryInodeNumber;
+        // Find the directory the file goes in, creating any that are missing
+        inodeNumber = makeDirectories(components);
+
+        // Check the client's preconditions against the file as it is now
+        int existingInodeNumber = this->fileSystem->lookup(inodeNumber, components.back());
+        string currentTag = existingInodeNumber < 0 ? "" : etag(existingInodeNumber);
+        if (request->hasHeader("If-Match") && (existingInodeNumber < 0 || !HttpUtils::strongEtagMatches(request->getHeader("If-Match"), currentTag))) {
+            throw ClientError::preconditionFailed();
+        }
+        if (request->hasHeader("If-None-Match") && existingInodeNumber >= 0 && HttpUtils::etagMatches(request->getHeader("If-None-Match"), currentTag)) {
+            throw ClientError::preconditionFailed();
         }
 
         // Create the file in the specified directory
         int entryInodeNumber = this->fileSystem->create(inodeNumber, UFS_REGULAR_FILE, components.back());
         if (entryInodeNumber < 0 && entryInodeNumber != -EINVALIDTYPE) { throw ClientError::badRequest(); }
 
-        // Write the contents to the file
-        entryInodeNumber = this->fileSystem->write(entryInodeNumber, request->getBody().data(), request->getBody().size());
-        if (entryInodeNumber < 0) { throw ClientError::insufficientStorage(); }
+        // Point the file at the blocks the body went to
+        if (this->fileSystem->commitWrite(entryInodeNumber, &staged.stream) < 0) { throw ClientError::insufficientStorage(); }
 
         // Commit the transaction and set the response status to success
-        this->fileSystem->disk->commit(); response->setStatus(200); return;
+        this->fileSystem->disk->commit(); staged.committed = true;
+        response->setHeader("ETag", etag(entryInodeNumber)); response->setStatus(200); return;
 
     }
     
-    // If any error occurs, rollback and throw error to signify request failure
-    catch (const ClientError& e) { this->fileSystem->disk->rollback(); throw e; }
+    // If any error occurs, rollback and rethrow
+    catch (...) { this->fileSystem->disk->rollback(); throw; }
 }
 
 void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *response) {
@@ -194,13 +446,25 @@ void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *respo
     // Remove the first element of the components (ds3)
     components.erase(components.begin());
 
+    // The only thing that can be deleted among the snapshots is a whole snapshot
+    checkComponents(components); bool snapshot = inSnapshots(components);
+    if (snapshot && components.size() != 2) { throw ClientError::forbidden(); }
+
     // Initialize the inode to the root directory inode number
     int inode = UFS_ROOT_DIRECTORY_INODE_NUMBER;
 
-    // Begin a transaction on the disk before making any changes to the file system
+    // Begin a transaction on the disk before making any changes to the file system, with everyone else locked out
+    FileSystemLock lock(&this->lock, true);
     this->fileSystem->disk->beginTransaction();
 
     try {
+        // Remove a snapshot and everything in it
+        if (snapshot) {
+            int result = this->fileSystem->removeSnapshot(components[1]);
+            if (result < 0) { throw (result == -ENOTFOUND ? ClientError::notFound() : ClientError::badRequest()); }
+            this->fileSystem->disk->commit(); response->setStatus(200); return;
+        }
+
         // Recursively search for the inode number of the desired directory/file
         for (size_t i = 0; i < components.size() - 1; ++i) {
             int entryInodeNumber = this->fileSystem->lookup(inode, components[i]);
@@ -220,3 +484,144 @@ void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *respo
     // If any error occurs, rollback and throw error to signify request failure
     catch (const ClientError& e) { this->fileSystem->disk->rollback(); throw e; }
 }
+
+void DistributedFileSystemService::move(HTTPRequest *request, HTTPResponse *response) {
+
+    /*
+     To rename a file or directory, use the HTTP MOVE method on its URL with the new location in the Destination
+     header, either as a path (/ds3/x/y) or as a full URL. Directories on the new path are created as with PUT,
+     an existing file (or empty directory) at the destination is replaced unless the request says Overwrite: F,
+     and only directory entries change, so a move costs the same whatever the size of what is moved.
+     */
+
+    // Split both URLs into components of the file system
+    vector<string> components = request->getPathComponents();
+    if (components.size() < 2 || components[0] != "ds3") { throw ClientError::notFound(); }
+    vector<string> target = destination(request);
+
+    // Remove the first element of the components (ds3)
+    components.erase(components.begin()); checkComponents(components);
+    if (inSnapshots(components) || inSnapshots(target)) { throw ClientError::forbidden(); }
+    bool overwrite = !request->hasHeader("Overwrite") || request->getHeader("Overwrite") != "F";
+
+    // Begin a transaction on the disk before making any changes to the file system, with everyone else locked out
+    FileSystemLock lock(&this->lock, true);
+    this->fileSystem->disk->beginTransaction();
+
+    try {
+        // Find the source's directory, it has to exist already
+        int srcInodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+        for (size_t i = 0; i + 1 < components.size(); ++i) {
+            srcInodeNumber = this->fileSystem->lookup(srcInodeNumber, components[i]);
+            if (srcInodeNumber < 0) { throw ClientError::notFound(); }
+        }
+        int entryInodeNumber = this->fileSystem->lookup(srcInodeNumber, components.back());
+        if (entryInodeNumber < 0) { throw ClientError::notFound(); }
+
+        // Find the destination's directory, creating any that are missing
+        int dstInodeNumber = makeDirectories(target);
+        if (!overwrite && this->fileSystem->lookup(dstInodeNumber, target.back()) >= 0) { throw ClientError::preconditionFailed(); }
+
+        // Move the entry
+        int result = this->fileSystem->rename(srcInodeNumber, components.back(), dstInodeNumber, target.back());
+        if (result == -ENOTENOUGHSPACE) { throw ClientError::insufficientStorage(); }
+        if (result == -EINVALIDTYPE || result == -EDIRNOTEMPTY || result == -EINVALIDMOVE) { throw ClientError::conflict(); }
+        if (result < 0) { throw ClientError::badRequest(); }
+
+        // Commit the transaction and set the response status to success
+        this->fileSystem->disk->commit(); response->setHeader("ETag", etag(entryInodeNumber)); response->setStatus(200); return;
+
+    }
+
+    // If any error occurs, rollback and throw error to signify request failure
+    catch (const ClientError& e) { this->fileSystem->disk->rollback(); throw e; }
+}
+
+void DistributedFileSystemService::copy(HTTPRequest *request, HTTPResponse *response) {
+
+    /*
+     To copy a file, use the HTTP COPY method on its URL with the new location in the Destination header, the
+     same way as MOVE. The copy shares the original's data blocks instead of having its own, so it costs the
+     same whatever the size of the file, and the two only stop sharing blocks once one of them is written.
+     Copying a directory is a conflict. Copying out of a snapshot is how a file is restored from it.
+     */
+
+    // Split both URLs into components of the file system
+    vector<string> components = request->getPathComponents();
+    if (components.size() < 2 || components[0] != "ds3") { throw ClientError::notFound(); }
+    vector<string> target = destination(request);
+
+    // Remove the first element of the components (ds3)
+    components.erase(components.begin()); checkComponents(components);
+    if (inSnapshots(target)) { throw ClientError::forbidden(); }
+    bool overwrite = !request->hasHeader("Overwrite") || request->getHeader("Overwrite") != "F";
+
+    // Begin a transaction on the disk before making any changes to the file system, with everyone else locked out
+    FileSystemLock lock(&this->lock, true);
+    this->fileSystem->disk->beginTransaction();
+
+    try {
+        // Find the source file, it has to exist already
+        int srcInodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+        for (size_t i = 0; i < components.size(); ++i) {
+            srcInodeNumber = this->fileSystem->lookup(srcInodeNumber, components[i]);
+            if (srcInodeNumber < 0) { throw ClientError::notFound(); }
+        }
+        inode_t source;
+        if (this->fileSystem->stat(srcInodeNumber, &source) < 0) { throw ClientError::notFound(); }
+        if (source.type != UFS_REGULAR_FILE) { throw ClientError::conflict(); }
+
+        // Find or create the destination file, creating any directories that are missing on the way
+        int dstParentInodeNumber = makeDirectories(target);
+        if (!overwrite && this->fileSystem->lookup(dstParentInodeNumber, target.back()) >= 0) { throw ClientError::preconditionFailed(); }
+        int dstInodeNumber = this->fileSystem->create(dstParentInodeNumber, UFS_REGULAR_FILE, target.back());
+        if (dstInodeNumber == -ENOTENOUGHSPACE) { throw ClientError::insufficientStorage(); }
+        if (dstInodeNumber == -EINVALIDTYPE) { throw ClientError::conflict(); }
+        if (dstInodeNumber < 0) { throw ClientError::badRequest(); }
+
+        // Share the source's blocks
+        int result = this->fileSystem->copy(srcInodeNumber, dstInodeNumber);
+        if (result < 0) { throw ClientError::badRequest(); }
+
+        // Commit the transaction and set the response status to success
+        this->fileSystem->disk->commit(); response->setHeader("ETag", etag(dstInodeNumber)); response->setStatus(200); return;
+
+    }
+
+    // If any error occurs, rollback and throw error to signify request failure
+    catch (const ClientError& e) { this->fileSystem->disk->rollback(); throw e; }
+}
+
+void DistributedFileSystemService::post(HTTPRequest *request, HTTPResponse *response) {
+
+    /*
+     To take a snapshot of the file system, POST to /ds3/.snapshots/<name>. Everything else in the file system can
+     then be read as it was at that moment under that path, and DELETE on the same URL removes the snapshot. Files
+     in a snapshot share their data blocks with the originals, so a snapshot only costs an inode per file and
+     directory and a block per directory, and snapshots can't be written to. POST anywhere else isn't allowed.
+     */
+
+    // Split the URL into components of the file system
+    vector<string> components = request->getPathComponents();
+    if (components.size() != 3 || components[0] != "ds3" || components[1] != SNAPSHOT_DIRECTORY) { throw ClientError::methodNotAllowed(); }
+    checkComponents(components);
+
+    // Begin a transaction on the disk before making any changes to the file system, with everyone else locked out
+    FileSystemLock lock(&this->lock, true);
+    this->fileSystem->disk->beginTransaction();
+
+    try {
+        // Take the snapshot
+        int result = this->fileSystem->snapshot(components[2]);
+        if (result == -ENOTENOUGHSPACE) { throw ClientError::insufficientStorage(); }
+        if (result == -ESNAPSHOTEXISTS || result == -EINVALIDTYPE) { throw ClientError::conflict(); }
+        if (result < 0) { throw ClientError::badRequest(); }
+
+        // Commit the transaction and set the response status to success
+        this->fileSystem->disk->commit(); response->setStatus(200); return;
+
+    }
+
+    // If any error occurs, rollback and throw error to signify request failure
+    catch (const ClientError& e) { this->fileSystem->disk->rollback(); throw e; }
+}
@@ -3,16 +3,19 @@
 #include <stdlib.h>
 #include <fcntl.h>
 
+#include <sys/stat.h>
+
 #include <iostream>
 #include <map>
 #include <string>
 
 #include "FileService.h"
 #include "ClientError.h"
+#include "HttpUtils.h"
 
 using namespace std;
 
-FileService::FileService(string basedir) : HttpService("/") {
+FileService::FileService(string basedir, size_t cacheBytes) : HttpService("/") {
   while (endswith(basedir, "/")) {
     basedir = basedir.substr(0, basedir.length() - 1);
   }
@@ -23,6 +26,11 @@ FileService::FileService(string basedir) : HttpService("/") {
   }
   
   this->m_basedir = basedir;
+  this->m_cacheBytes = 0;
+  this->m_cacheCapacity = cacheBytes;
+  this->m_cacheHits = 0;
+  this->m_cacheMisses = 0;
+  pthread_mutex_init(&m_cacheLock, NULL);
 }
 
 bool FileService::endswith(string str, string suffix) {
@@ -30,41 +38,183 @@ bool FileService::endswith(string str, string suffix) {
   return pos == (str.length() - suffix.length());
 }
 
+// FNV-1a over the contents, so the tag only changes when the bytes do
+static string contentEtag(const string &contents) {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t idx = 0; idx < contents.size(); idx++) {
+    hash ^= (unsigned char) contents[idx];
+    hash *= 1099511628211ULL;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "\"%016llx\"", hash);
+  return buf;
+}
+
+// files we don't cache get a tag from their metadata instead
+static string metadataEtag(const struct stat &st) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%llx-%llx-%llx\"", (unsigned long long) st.st_ino,
+	   (unsigned long long) st.st_size, (unsigned long long) st.st_mtime);
+  return buf;
+}
+
 void FileService::get(HTTPRequest *request, HTTPResponse *response) {
-  string path = this->m_basedir + request->getPath();
-  string fileContents = this->readFile(path);
-  if (fileContents.size() == 0) {
-    throw ClientError::notFound();
-  } else {
-    if (this->endswith(path, ".css")) {
-      response->setContentType("text/css");
-    } else if (this->endswith(path, ".js")) {
-      response->setContentType("text/javascript");
+  string path = this->m_basedir + request->getPath().str();
+
+  CachedFile file;
+  int fd = -1;
+  if (!this->cacheLookup(path, &file)) {
+    struct stat st;
+    fd = this->openFile(path, &st);
+    if (fd < 0) {
+      throw ClientError::notFound();
+    }
+
+    file.mtime = st.st_mtime;
+    file.size = st.st_size;
+    if (st.st_size <= FILE_CACHE_MAX_ENTRY_BYTES) {
+      file.contents = make_shared<const string>(this->readFile(fd, st.st_size));
+      file.etag = contentEtag(*file.contents);
+      file.inode = st.st_ino;
+      this->cacheInsert(path, file);
+      close(fd);
+      fd = -1;
+    } else {
+      file.etag = metadataEtag(st);
     }
-    response->setBody(fileContents);
   }
+
+  if (this->endswith(path, ".css")) {
+    response->setContentType("text/css");
+  } else if (this->endswith(path, ".js")) {
+    response->setContentType("text/javascript");
+  }
+  response->setHeader("ETag", file.etag);
+  response->setHeader("Last-Modified", HttpUtils::formatDate(file.mtime));
+
+  if (this->notModified(request, file.etag, file.mtime)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    response->setStatus(304);
+  } else if (fd >= 0) {
+    response->setBodyFile(fd, file.size);
+  } else {
+    response->setBody(file.contents);
+  }
+}
+
+bool FileService::notModified(HTTPRequest *request, string etag, time_t mtime) {
+  // If-None-Match takes precedence, If-Modified-Since is only a fallback
+  if (request->hasHeader("If-None-Match")) {
+    return HttpUtils::etagMatches(request->getHeader("If-None-Match"), etag);
+  }
+
+  time_t since;
+  if (request->hasHeader("If-Modified-Since") &&
+      HttpUtils::parseDate(request->getHeader("If-Modified-Since"), &since)) {
+    return mtime <= since;
+  }
+
+  return false;
 }
 
-string FileService::readFile(string path) {
+// returns an open descriptor for a non-empty regular file, or -1
+int FileService::openFile(string path, struct stat *st) {
   int fd = open(path.c_str(), O_RDONLY);
   if (fd < 0) {
-    return "";
+    return -1;
   }
 
+  if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode) || st->st_size == 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+string FileService::readFile(int fd, size_t size) {
   string result;
+  result.reserve(size);
+
   int ret;
   char buffer[4096];
   while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
     result.append(buffer, ret);
   }
 
-  close(fd);
-  
   return result;
 }
 
+bool FileService::cacheLookup(string path, CachedFile *file) {
+  bool found = false;
+  pthread_mutex_lock(&m_cacheLock);
+
+  map<string, CachedFile>::iterator iter = m_cache.find(path);
+  if (iter != m_cache.end()) {
+    CachedFile &entry = iter->second;
+    time_t now = time(NULL);
+    found = true;
+
+    // only go back to the file system once the entry is old enough
+    if (now - entry.lastChecked >= FILE_CACHE_REVALIDATE_SECONDS) {
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 || st.st_mtime != entry.mtime ||
+	  st.st_size != entry.size || st.st_ino != entry.inode) {
+	cacheErase(iter);
+	found = false;
+      } else {
+	entry.lastChecked = now;
+      }
+    }
+
+    if (found) {
+      m_lru.splice(m_lru.begin(), m_lru, entry.lruPosition);
+      *file = entry;
+    }
+  }
+
+  pthread_mutex_unlock(&m_cacheLock);
+  if (found) {
+    m_cacheHits++;
+  } else {
+    m_cacheMisses++;
+  }
+  return found;
+}
+
+void FileService::cacheInsert(string path, CachedFile file) {
+  pthread_mutex_lock(&m_cacheLock);
+
+  map<string, CachedFile>::iterator iter = m_cache.find(path);
+  if (iter != m_cache.end()) {
+    cacheErase(iter);
+  }
+
+  while (!m_lru.empty() && m_cacheBytes + file.size > m_cacheCapacity) {
+    cacheErase(m_cache.find(m_lru.back()));
+  }
+
+  if (m_cacheBytes + file.size <= m_cacheCapacity) {
+    file.lastChecked = time(NULL);
+    file.lruPosition = m_lru.insert(m_lru.begin(), path);
+    m_cache[path] = file;
+    m_cacheBytes += file.size;
+  }
+
+  pthread_mutex_unlock(&m_cacheLock);
+}
+
+// caller holds m_cacheLock
+void FileService::cacheErase(map<string, CachedFile>::iterator iter) {
+  m_cacheBytes -= iter->second.size;
+  m_lru.erase(iter->second.lruPosition);
+  m_cache.erase(iter);
+}
+
 void FileService::head(HTTPRequest *request, HTTPResponse *response) {
   // HEAD is the same as get but with no body
   this->get(request, response);
-  response->setBody("");
+  response->withoutBody();
 }
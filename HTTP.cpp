@@ -14,6 +14,11 @@ using namespace std;
 int HTTP::message_begin_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
+    if(http->getState() == HTTP::DONE) {
+        // a pipelined request right behind this one, stop the parser
+        // in front of it rather than run on into a second message
+        return -1;
+    }
     assert(http->getState() == HTTP::INIT);
     http->setState(HTTP::HEADER);
     return 0;
@@ -22,20 +27,20 @@ int HTTP::message_begin_cb(http_parser *parser)
 int HTTP::path_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->m_path.append(at, length);
+    http->append(&http->m_path, at, length);
     return 0;
 }
 int HTTP::query_string_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->m_query.append(at, length);
+    http->append(&http->m_query, at, length);
     return 0;
 }
 
 int HTTP::url_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->appendUrl(at, length);
+    http->append(&http->m_url, at, length);
 
     return 0;
 }
@@ -55,7 +60,12 @@ int HTTP::header_field_cb(http_parser *parser, const char *at, size_t length)
         http->appendHeaderField(at, length);
     } else if((http->getState() == HTTP::VALUE) ||
               (http->getState() == HTTP::HEADER)) {
-        http->newHeaderField(at, length);
+        if(!http->newHeaderField(at, length)) {
+            // too many headers, fail the parse
+            http->m_failed = true;
+            http->m_headerTooLarge = true;
+            return -1;
+        }
         http->setState(HTTP::FIELD);
     } else {
         assert(false);
@@ -78,8 +88,19 @@ int HTTP::header_value_cb(http_parser *parser, const char *at, size_t length)
 int HTTP::headers_complete_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->addHeaderField();
+    http->indexHeaders();
     http->m_headerDone = true;
+    http->m_contentLength = parser->content_length;
+    if(http->m_httpType == HTTP_REQUEST) {
+        // the method is known now, callers dispatch before the body arrives
+        http->m_method = parser->method;
+        if(http->m_maxBodyBytes >= 0 && http->m_contentLength > http->m_maxBodyBytes) {
+            // refuse before any of the body is read
+            http->m_failed = true;
+            http->m_bodyTooLarge = true;
+            return -1;
+        }
+    }
 
     if(http->m_httpType == HTTP_RESPONSE) {
         char buf[64];
@@ -119,7 +140,18 @@ int HTTP::headers_complete_cb(http_parser *parser)
 int HTTP::body_cb(http_parser *parser, const char *at, size_t length)
 {
     HTTP *http = (HTTP *) parser->data;
-    http->m_body.append(at, length);
+    http->m_bodyBytes += length;
+    if(http->m_maxBodyBytes >= 0 && http->m_bodyBytes > http->m_maxBodyBytes) {
+        // a chunked body that didn't declare its length up front
+        http->m_failed = true;
+        http->m_bodyTooLarge = true;
+        return -1;
+    }
+    if(http->m_bodySink != NULL) {
+        http->m_bodySink->onBody(at, length);
+    } else {
+        http->m_body.append(at, length);
+    }
 
     return 0;
 }
@@ -127,7 +159,9 @@ int HTTP::body_cb(http_parser *parser, const char *at, size_t length)
 int HTTP::message_complete_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
-    assert((http->getState() == HTTP::VALUE) || 
+    // HEADER when the request had no header lines at all
+    assert((http->getState() == HTTP::HEADER) ||
+           (http->getState() == HTTP::VALUE) || 
            (http->getState() == HTTP::BODY));
     http->setState(HTTP::DONE);
     http->messageComplete(parser->method);
@@ -162,62 +196,112 @@ HTTP::HTTP(http_parser_type httpType)
 
     m_parser.data = this;
 
-    m_field = NULL;
-    m_value = NULL;
+    m_failed = false;
+    m_spilled = false;
+    m_arenaSize = 0;
+    m_url.offset = m_url.length = 0;
+    m_path = m_query = m_url;
+    m_headerCount = 0;
     m_extraParsedBytes = 0;
+    m_bodySink = NULL;
+    m_contentLength = -1;
+    m_bodyBytes = 0;
+    m_maxHeaderBytes = 0;
+    m_maxBodyBytes = -1;
+    m_headerTooLarge = false;
+    m_bodyTooLarge = false;
+    m_method = HTTP_GET;
 }
 
 HTTP::~HTTP()
 {
-    if(m_field != NULL) {
-        delete m_field;
-    }
-
-    if(m_value != NULL) {
-        delete m_value;
-    }
-
-    for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        delete m_headers[idx].first;
-        delete m_headers[idx].second;
-    }
 }
 
 int HTTP::addData(const unsigned char *data, int len)
 {
+    if(m_failed) {
+        return -1;
+    }
     if(m_doneParsing) {
         assert(false);
     }
     int ret = http_parser_execute(&m_parser, &m_settings, (const char *) data, len);
+    if(m_maxHeaderBytes > 0 && m_arenaSize > m_maxHeaderBytes) {
+        // only header text goes into the arena
+        m_failed = true;
+        m_headerTooLarge = true;
+    }
+    if(m_failed) {
+        // the parser doesn't remember a callback failing, so we do
+        return -1;
+    }
     ret += m_extraParsedBytes;
     m_extraParsedBytes = 0;
     return ret;
 }
 
-string HTTP::getBody()
+const string &HTTP::getBody()
 {
     return m_body;
 }
 
-string HTTP::getUrl()
+void HTTP::setBodySink(HttpBodySink *sink)
 {
-    return m_url;
+    m_bodySink = sink;
+    if(sink != NULL && m_body.size() > 0) {
+        sink->onBody(m_body.data(), m_body.size());
+        m_body.clear();
+    }
 }
 
-string HTTP::getPath()
+void HTTP::setLimits(size_t maxHeaderBytes, int64_t maxBodyBytes)
 {
-    return m_path;
+    m_maxHeaderBytes = maxHeaderBytes;
+    m_maxBodyBytes = maxBodyBytes;
 }
 
 string HTTP::getHost()
 {
-    string host = (m_method == HTTP_CONNECT) ? m_url : m_host;
+    StringSlice hostHeader;
+    string host = (m_method == HTTP_CONNECT) ? getUrl().str() : (findHeader("Host", &hostHeader) ? hostHeader.str() : "");
     if(host.find(':') == string::npos) {
         host += ":80";
     }
     return host;
 }
 
+// case-insensitive ordering of header names, shorter names first on a tie
+static int compareFields(const StringSlice &a, const StringSlice &b)
+{
+    int ret = strncasecmp(a.data(), b.data(), a.size() < b.size() ? a.size() : b.size());
+    if(ret != 0) {
+        return ret;
+    }
+    return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+bool HTTP::findHeader(const char *field, StringSlice *value)
+{
+    StringSlice wanted(field, strlen(field));
+
+    // lower bound in the index, so the first of any repeats is found
+    size_t low = 0, high = m_headerCount;
+    while(low < high) {
+        size_t mid = (low + high) / 2;
+        if(compareFields(getHeaderField(m_headerIndex[mid]), wanted) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if(low < m_headerCount && compareFields(getHeaderField(m_headerIndex[low]), wanted) == 0) {
+        *value = getHeaderValue(m_headerIndex[low]);
+        return true;
+    }
+    return false;
+}
+
 bool HTTP::isHeaderDone()
 {
     return m_headerDone;
@@ -238,9 +322,9 @@ string HTTP::getReplyHeader()
     reply = m_statusStr + "\r\n";
 
     bool foundConn = false;
-    for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        string field = *(m_headers[idx].first);
-        string value = *(m_headers[idx].second);
+    for(unsigned int idx = 0; idx < m_headerCount; idx++) {
+        string field = getHeaderField(idx).str();
+        string value = getHeaderValue(idx).str();
 
         if(field == "Connection") {
             value = "close";
@@ -266,21 +350,22 @@ string HTTP::getProxyRequest(const char *userAgent)
 
     assert(m_httpType == HTTP_REQUEST);
 
+    string url = getUrl().str(), path = getPath().str(), query = getQuery().str();
     if((m_method == HTTP_GET) || (m_method == HTTP_POST) || (m_method == HTTP_HEAD)) {
-        if(m_path.size() == 0) {
+        if(path.size() == 0) {
             urlPathQuery = "/";
         } else {
-            urlPathQuery = m_path;
+            urlPathQuery = path;
         }
-        if(m_query.size() > 0) {
-            urlPathQuery += "?" + m_query;
+        if(query.size() > 0) {
+            urlPathQuery += "?" + query;
         }
-        if(m_url.find(urlPathQuery) == string::npos) {
+        if(url.find(urlPathQuery) == string::npos) {
             // this is a hack to get around buggy HTML from taobao
-            assert(m_query.size() > 0);
-            urlPathQuery = m_path + "??" + m_query;
-            if(m_url.find(urlPathQuery) == string::npos) {
-                cout << "url path mismatch " << m_url << endl << urlPathQuery << endl;
+            assert(query.size() > 0);
+            urlPathQuery = path + "??" + query;
+            if(url.find(urlPathQuery) == string::npos) {
+                cout << "url path mismatch " << url << endl << urlPathQuery << endl;
             }
         }
     }
@@ -288,7 +373,7 @@ string HTTP::getProxyRequest(const char *userAgent)
     if(m_method == HTTP_GET) {
         reply = "GET " + urlPathQuery + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_CONNECT) {
-        reply = "CONNECT " + m_url + " HTTP/1.1\r\n";
+        reply = "CONNECT " + url + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_POST) {
         reply = "POST " + urlPathQuery + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_HEAD) {
@@ -297,9 +382,9 @@ string HTTP::getProxyRequest(const char *userAgent)
         assert(false);
     }
 
-    for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        string field = *(m_headers[idx].first);
-        string value = *(m_headers[idx].second);
+    for(unsigned int idx = 0; idx < m_headerCount; idx++) {
+        string field = getHeaderField(idx).str();
+        string value = getHeaderValue(idx).str();
 
         if((userAgent != NULL) && (field == "User-Agent")) {
             value = string(userAgent);
@@ -345,50 +430,77 @@ void HTTP::setState(HttpState newState)
     m_state = newState;
 }
 
-void HTTP::appendUrl(const char *at, size_t len)
+// copies request text into the arena, growing span if it was the last
+// thing appended
+void HTTP::append(Span *span, const char *at, size_t len)
 {
-    m_url.append(at, len);
-}
+    // the parser interleaves url, path and query pieces, move a span that
+    // something else has been appended after so it stays contiguous
+    if(span->length > 0 && span->offset + span->length != m_arenaSize) {
+        string existing(arena() + span->offset, span->length);
+        span->length = 0;
+        append(span, existing.data(), existing.size());
+    }
+    if(span->length == 0) {
+        span->offset = m_arenaSize;
+    }
 
-void HTTP::addHeaderField()
-{
-    if(m_field != NULL) {
-        assert(m_value != NULL);
-        if(*m_field == "Host") {
-            m_host = *m_value;
-        }
-        if(*m_field == "Eoh") {
-            cout << "got the Eoh header" << endl;
-        }
-        m_headers.insert(m_headers.end(), pair<string *, string *>(m_field, m_value));
-        m_field = NULL;
-        m_value = NULL;
+    if(!m_spilled && m_arenaSize + len <= HTTP_ARENA_INLINE_BYTES) {
+        memcpy(m_inline + m_arenaSize, at, len);
     } else {
-        assert(m_value == NULL);
+        if(!m_spilled) {
+            m_spill.assign(m_inline, m_arenaSize);
+            m_spilled = true;
+        }
+        m_spill.append(at, len);
     }
+    m_arenaSize += len;
+    span->length += len;
 }
 
-void HTTP::newHeaderField(const char *at, size_t len)
+bool HTTP::newHeaderField(const char *at, size_t len)
 {
-    addHeaderField();
-    m_field = new string(at, len);
-    m_value = new string();
+    if(m_headerCount == HTTP_MAX_HEADERS) {
+        return false;
+    }
+    HeaderSpan *header = &m_headers[m_headerCount++];
+    header->field.offset = header->field.length = 0;
+    header->value = header->field;
+    append(&header->field, at, len);
+    return true;
 }
+
 void HTTP::appendHeaderField(const char *at, size_t len)
 {
-    assert(m_field != NULL);
-    m_field->append(at, len);
+    assert(m_headerCount > 0);
+    append(&m_headers[m_headerCount - 1].field, at, len);
 }
 
 void HTTP::appendHeaderValue(const char *at, size_t len)
 {
-    m_value->append(at, len);
+    assert(m_headerCount > 0);
+    append(&m_headers[m_headerCount - 1].value, at, len);
+}
+
+// sorts the header positions by name once so lookups can binary search;
+// insertion sort keeps repeated headers in request order
+void HTTP::indexHeaders()
+{
+    for(size_t idx = 0; idx < m_headerCount; idx++) {
+        uint8_t current = idx;
+        size_t pos = idx;
+        while(pos > 0 && compareFields(getHeaderField(m_headerIndex[pos - 1]), getHeaderField(current)) > 0) {
+            m_headerIndex[pos] = m_headerIndex[pos - 1];
+            pos--;
+        }
+        m_headerIndex[pos] = current;
+    }
 }
 
 void HTTP::messageComplete(unsigned char method)
 {
     if(m_httpType == HTTP_REQUEST) {
-      assert((method == HTTP_GET) || (method == HTTP_CONNECT) || (method == HTTP_POST) || (method == HTTP_HEAD) || (method == HTTP_PUT) || (method == HTTP_DELETE) || (method == HTTP_MOVE));
+      assert((method == HTTP_GET) || (method == HTTP_CONNECT) || (method == HTTP_POST) || (method == HTTP_HEAD) || (method == HTTP_PUT) || (method == HTTP_DELETE) || (method == HTTP_MOVE) || (method == HTTP_COPY));
         m_method = method;
     }
     m_doneParsing = true;
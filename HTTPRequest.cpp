@@ -1,13 +1,16 @@
 #include "HTTPRequest.h"
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 #include <assert.h>
 #include <errno.h>
 
+#include "ClientError.h"
 #include "HttpUtils.h"
 #include "StringUtils.h"
+#include "Trace.h"
 
 using namespace std;
 
@@ -36,65 +39,117 @@ void HTTPRequest::printDebugInfo()
 }
 
 map<string, string> HTTPRequest::getParams() {
-  return HttpUtils::params(m_http->getQuery());
+  return HttpUtils::params(m_http->getQuery().str());
 }
 
 WwwFormEncodedDict HTTPRequest::formEncodedBody() {
-  WwwFormEncodedDict dict(m_http->getBody());
+  WwwFormEncodedDict dict(getBody());
   return dict;
 }
 
-string HTTPRequest::getPath() {
+StringSlice HTTPRequest::getPath() {
   return m_http->getPath();
 }
 
-string HTTPRequest::getHeader(string key) {
-  vector<pair<string *, string *> >::iterator iter;
-  vector<pair<string *, string *> > headers = m_http->getHeaders();
-  for (iter = headers.begin(); iter != headers.end(); iter++) {
-    string header_key = *(iter->first);
-    if (header_key == key) {
-      return *(iter->second);
-    }
+bool HTTPRequest::findHeader(const char *key, StringSlice *value) {
+  return m_http->findHeader(key, value);
+}
+
+string HTTPRequest::getHeader(const char *key) {
+  StringSlice value;
+  if (!m_http->findHeader(key, &value)) {
+    throw "could not find header";
   }
+  return value.str();
+}
 
-  throw "could not find header";
+bool HTTPRequest::hasHeader(const char *key) {
+  StringSlice value;
+  return m_http->findHeader(key, &value);
 }
 
 bool HTTPRequest::hasAuthToken() {
-  try {
-    getHeader("x-auth-token");
-    return true;
-  } catch (...) {
-    return false;
-  }
+  return hasHeader("x-auth-token");
 }
 
 string HTTPRequest::getAuthToken() {
-  try {
-    return getHeader("x-auth-token");
-  } catch (...) {
-    return "";
-  }
+  StringSlice value;
+  return findHeader("x-auth-token", &value) ? value.str() : "";
 }
 
 vector<string> HTTPRequest::getPathComponents() {
-  return StringUtils::split(getPath(), '/');
+  return StringUtils::split(getPath().str(), '/');
 }
 
 bool HTTPRequest::readRequest()
 {
     assert(!m_http->isDone());
 
-    string readData;
     while(!m_http->isDone()) {
-        readData = m_sock->read();
-	onRead(readData.c_str(), readData.size());
+        readMore();
     }
 
     return true;
 }
 
+bool HTTPRequest::readHeaders()
+{
+    assert(!m_http->isHeaderDone());
+
+    while(!m_http->isHeaderDone()) {
+        readMore();
+    }
+
+    return true;
+}
+
+void HTTPRequest::readBody(HttpBodySink *sink)
+{
+    TraceSpan span(TRACE_BODY);
+    m_http->setBodySink(sink);
+    if(!m_http->isDone()) {
+        readBodyBytes();
+    }
+    m_http->setBodySink(NULL);
+}
+
+class DiscardBodySink : public HttpBodySink {
+ public:
+    void onBody(const char *, size_t) {}
+};
+
+void HTTPRequest::discardBody()
+{
+    DiscardBodySink sink;
+    readBody(&sink);
+}
+
+const string &HTTPRequest::getBody()
+{
+    if(!m_http->isDone()) {
+        TraceSpan span(TRACE_BODY);
+        readBodyBytes();
+    }
+    return m_http->getBody();
+}
+
+void HTTPRequest::readBodyBytes()
+{
+    try {
+        readRequest();
+    } catch(SocketTimeout &) {
+        // the headers made it but the body didn't, that's the client's fault
+        throw ClientError::requestTimeout();
+    }
+}
+
+void HTTPRequest::readMore()
+{
+    static thread_local char buffer[HTTP_READ_BUFFER_BYTES];
+    size_t len = m_sock->read(buffer, sizeof(buffer));
+    onRead(buffer, len);
+}
+
 void HTTPRequest::onRead(const char *buffer, unsigned int len)
 {
     m_totalBytesRead += len;
@@ -105,7 +160,16 @@ void HTTPRequest::onRead(const char *buffer, unsigned int len)
     while(bytesRead < len) {
         assert(!m_http->isDone());
         int ret = m_http->addData((const unsigned char *) (buffer + bytesRead), len - bytesRead);
-        assert(ret > 0);
+        if(ret <= 0 && m_http->isHeaderTooLarge()) {
+            throw ClientError::headerFieldsTooLarge();
+        }
+        if(ret <= 0 && m_http->isBodyTooLarge()) {
+            throw ClientError::payloadTooLarge();
+        }
+        if(ret <= 0) {
+            // the parser stopped on something it couldn't make sense of
+            throw runtime_error("malformed request");
+        }
         bytesRead += ret;
         
         // This is a workaround for a parsing bug that sometimes
@@ -116,7 +180,9 @@ void HTTPRequest::onRead(const char *buffer, unsigned int len)
             if(m_http->isConnect() && ((len-bytesRead) == 1) && (buffer[bytesRead] == '\n')) {
                 break;
             } else {
-                assert(false);
+                // a pipelined request behind this one; we close the
+                // connection after answering, so it goes unanswered
+                break;
             }
         }
     }
@@ -130,7 +196,7 @@ string HTTPRequest::getRequest()
 {
     return m_http->getProxyRequest();
 }
-string HTTPRequest::getUrl()
+StringSlice HTTPRequest::getUrl()
 {
     return m_http->getUrl();
 }
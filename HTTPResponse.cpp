@@ -1,26 +1,78 @@
-#include <sstream>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
 
 #include "HTTPResponse.h"
+#include "HttpUtils.h"
 
 using namespace std;
 
 HTTPResponse::HTTPResponse() {
   this->streaming = false;
+  this->sendBody = true;
   this->contentType = "text/html; charset=ISO-8859-1";
   this->headers["Server"] = "Gunrock Web";
   this->status = 200;
+  this->bodyData = NULL;
+  this->bodyLength = 0;
+  this->bodyFd = -1;
+}
+
+HTTPResponse::~HTTPResponse() {
+  clearBody();
 }
 
 void HTTPResponse::withStreaming() {
   this->streaming = true;
 }
 
+void HTTPResponse::withoutBody() {
+  this->sendBody = false;
+}
+
 void HTTPResponse::setHeader(string name, string value) {
   this->headers[name] = value;
 }
 
 void HTTPResponse::setBody(string data) {
-  body = data;
+  clearBody();
+  if (data.size() > 0) {
+    shared_ptr<string> owned = make_shared<string>(std::move(data));
+    bodyData = owned->data();
+    bodyLength = owned->size();
+    bodyOwner = owned;
+  }
+}
+
+void HTTPResponse::setBody(shared_ptr<const string> data) {
+  clearBody();
+  bodyData = data->data();
+  bodyLength = data->size();
+  bodyOwner = data;
+}
+
+void HTTPResponse::setBodyFile(int fd, size_t length) {
+  clearBody();
+  bodyFd = fd;
+  bodyLength = length;
+}
+
+void HTTPResponse::setBodySource(shared_ptr<HttpBodySource> source, size_t length) {
+  clearBody();
+  bodySource = source;
+  bodyLength = length;
+}
+
+void HTTPResponse::clearBody() {
+  if (bodyFd >= 0) {
+    close(bodyFd);
+    bodyFd = -1;
+  }
+  bodyData = NULL;
+  bodyLength = 0;
+  bodyOwner.reset();
+  bodySource.reset();
 }
 
 int HTTPResponse::getStatus() {
@@ -35,34 +87,135 @@ void HTTPResponse::setStatus(int status) {
   this->status = status;
 }
 
-string HTTPResponse::statusToString() {
-  if (status == 200) {
-    return "OK";
-  } else {
-    return "Unknown";
+const char *HTTPResponse::statusToString() {
+  switch (status) {
+  case 200: return "OK";
+  case 206: return "Partial Content";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 401: return "Unauthorized";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 408: return "Request Timeout";
+  case 409: return "Conflict";
+  case 412: return "Precondition Failed";
+  case 413: return "Payload Too Large";
+  case 416: return "Range Not Satisfiable";
+  case 431: return "Request Header Fields Too Large";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  case 503: return "Service Unavailable";
+  case 507: return "Insufficient Storage";
+  default: return "Unknown";
   }
 }
 
-string HTTPResponse::response() {
-  stringstream out;
+// formats the status line and headers into a per-thread buffer that keeps
+// its capacity from one response to the next
+const string &HTTPResponse::header() {
+  static thread_local string out;
+  char line[64];
+
   setHeader("Content-Type", contentType);
+  // every connection is closed after one response, say so up front so a
+  // keep-alive client doesn't hold on to it
+  setHeader("Connection", "close");
   if (streaming) {
     setHeader("Transfer-Encoding", "chunked");
+  } else if (status == 304) {
+    // a 304 has no body and must not advertise one
+    headers.erase("Content-Length");
   } else {
-    stringstream len;
-    len << body.size();
-    setHeader("Content-Length", len.str());
+    snprintf(line, sizeof(line), "%zu", bodyLength);
+    setHeader("Content-Length", line);
   }
 
-  out << "HTTP/1.1 " << status << " " << statusToString() << "\r\n";
+  out.clear();
+  snprintf(line, sizeof(line), "HTTP/1.1 %d ", status);
+  out.append(line);
+  out.append(statusToString());
+  out.append("\r\n");
   map<string, string>::iterator iter;
   for(iter = headers.begin(); iter != headers.end(); iter++) {
-    out << iter->first << ": " << iter->second << "\r\n";
+    out.append(iter->first);
+    out.append(": ");
+    out.append(iter->second);
+    out.append("\r\n");
   }
-  out << "\r\n";
-  if (body.size() > 0 && !streaming) {
-    out << body;
+  out.append("\r\n");
+
+  return out;
+}
+
+string HTTPResponse::response() {
+  string out = header();
+  if (bodyData != NULL && !streaming && sendBody) {
+    out.append(bodyData, bodyLength);
+  }
+
+  return out;
+}
+
+void HTTPResponse::send(MySocket *client) {
+  const string &head = header();
+
+  if (bodySource) {
+    client->write(head);
+    if (sendBody) {
+      sendSource(client);
+    }
+    return;
+  }
+
+  bool withBody = bodyLength > 0 && !streaming && sendBody;
+
+  if (bodyFd >= 0) {
+    client->write(head);
+    if (withBody) {
+      client->sendfile(bodyFd, 0, bodyLength);
+    }
+    return;
   }
 
-  return out.str();
+  struct iovec iov[2];
+  iov[0].iov_base = (void *) head.data();
+  iov[0].iov_len = head.size();
+  iov[1].iov_base = (void *) bodyData;
+  iov[1].iov_len = withBody ? bodyLength : 0;
+  client->writev(iov, withBody ? 2 : 1);
+}
+
+// the headers are already out, so if the source fails part way the only
+// thing left to do is cut the connection short
+void HTTPResponse::sendSource(MySocket *client) {
+  char buffer[BODY_SOURCE_BUFFER_BYTES];
+  size_t sent = 0;
+
+  while (streaming || sent < bodyLength) {
+    size_t want = sizeof(buffer);
+    if (!streaming && bodyLength - sent < want) {
+      want = bodyLength - sent;
+    }
+    int bytesRead = bodySource->read(buffer, want);
+    if (bytesRead < 0 || (bytesRead == 0 && !streaming)) {
+      throw SocketWriteError();
+    }
+    if (bytesRead == 0) {
+      break;
+    }
+    if (streaming) {
+      HttpUtils::writeChunk(client, buffer, bytesRead);
+    } else {
+      struct iovec iov;
+      iov.iov_base = buffer;
+      iov.iov_len = bytesRead;
+      client->writev(&iov, 1);
+    }
+    sent += bytesRead;
+  }
+
+  if (streaming) {
+    HttpUtils::writeLastChunk(client);
+  }
 }
@@ -1,4 +1,8 @@
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "HttpUtils.h"
 
@@ -69,3 +73,137 @@ vector<string> HttpUtils::split(const string &s, char delim) {
   }
   return result;
 }
+
+string HttpUtils::formatDate(time_t when) {
+  struct tm tm;
+  char buf[64];
+  gmtime_r(&when, &tm);
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buf;
+}
+
+bool HttpUtils::parseDate(string date, time_t *when) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (end == NULL || *end != '\0') {
+    return false;
+  }
+  *when = timegm(&tm);
+  return true;
+}
+
+// weak comparison ignores a W/ prefix on either side, strong comparison
+// (RFC 7232 2.3.2) never matches a weak tag
+static bool etagListMatches(const string &headerValue, const string &etag, bool weak) {
+  if (!weak && etag.find("W/") == 0) {
+    return false;
+  }
+  vector<string> candidates = HttpUtils::split(headerValue, ',');
+  for (unsigned int idx = 0; idx < candidates.size(); idx++) {
+    string candidate = candidates[idx];
+    size_t start = candidate.find_first_not_of(" \t");
+    size_t end = candidate.find_last_not_of(" \t");
+    if (start == string::npos) {
+      continue;
+    }
+    candidate = candidate.substr(start, end - start + 1);
+
+    if (candidate.find("W/") == 0) {
+      if (!weak) {
+        continue;
+      }
+      candidate = candidate.substr(2);
+    }
+    if (candidate == "*" || candidate == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HttpUtils::etagMatches(string headerValue, string etag) {
+  return etagListMatches(headerValue, etag, true);
+}
+
+bool HttpUtils::strongEtagMatches(string headerValue, string etag) {
+  return etagListMatches(headerValue, etag, false);
+}
+
+// parses a run of digits covering all of s, the only form a byte
+// position may take
+static bool parseBytePosition(const string &s, int64_t *value) {
+  if (s.size() == 0 || s.size() > 18 || s.find_first_not_of("0123456789") != string::npos) {
+    return false;
+  }
+  *value = strtoll(s.c_str(), NULL, 10);
+  return true;
+}
+
+bool HttpUtils::parseRange(string headerValue, int64_t size,
+			   vector<pair<int64_t, int64_t> > *ranges) {
+  ranges->clear();
+  if (headerValue.find("bytes=") != 0) {
+    return false;
+  }
+
+  vector<string> specs = split(headerValue.substr(6), ',');
+  bool sawSpec = false;
+  for (unsigned int idx = 0; idx < specs.size(); idx++) {
+    string spec = specs[idx];
+    size_t start = spec.find_first_not_of(" \t");
+    size_t end = spec.find_last_not_of(" \t");
+    if (start == string::npos) {
+      continue;
+    }
+    spec = spec.substr(start, end - start + 1);
+    sawSpec = true;
+
+    size_t dash = spec.find('-');
+    if (dash == string::npos) {
+      return false;
+    }
+    string firstText = spec.substr(0, dash);
+    string lastText = spec.substr(dash + 1);
+    int64_t first, last;
+
+    if (firstText.size() == 0) {
+      // suffix range, the final N bytes
+      if (!parseBytePosition(lastText, &last)) {
+	return false;
+      }
+      if (last == 0 || size == 0) {
+	continue;
+      }
+      first = last >= size ? 0 : size - last;
+      last = size - 1;
+    } else {
+      if (!parseBytePosition(firstText, &first)) {
+	return false;
+      }
+      if (lastText.size() == 0) {
+	last = size - 1;
+      } else if (!parseBytePosition(lastText, &last) || last < first) {
+	return false;
+      }
+      if (first >= size) {
+	continue;
+      }
+      last = min(last, size - 1);
+    }
+    ranges->push_back(make_pair(first, last));
+  }
+
+  // coalesce overlapping and adjacent ranges so each byte is sent once
+  sort(ranges->begin(), ranges->end());
+  vector<pair<int64_t, int64_t> > merged;
+  for (unsigned int idx = 0; idx < ranges->size(); idx++) {
+    if (merged.size() > 0 && (*ranges)[idx].first <= merged.back().second + 1) {
+      merged.back().second = max(merged.back().second, (*ranges)[idx].second);
+    } else {
+      merged.push_back((*ranges)[idx]);
+    }
+  }
+  ranges->swap(merged);
+  return sawSpec;
+}
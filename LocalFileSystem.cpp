@@ -6,6 +6,7 @@
 #include <assert.h>
 
 #include "LocalFileSystem.h"
+#include "Trace.h"
 #include "ufs.h"
 
 using namespace std;
@@ -31,9 +32,58 @@ using namespace std;
 //// Unlinking '.' or '..'
 //#define EUNLINKNOTALLOWED  (10)
 
-LocalFileSystem::LocalFileSystem(Disk *disk) { this->disk = disk; }
+LocalFileSystem::LocalFileSystem(Disk *disk) {
+    this->disk = disk; this->lastGeneration = 0;
+    this->sharedBlocksLoaded = false; this->sharedBlocksRollbacks = 0;
+    this->deduplicate = false; this->fingerprintsLoaded = false;
+
+    // Let the disk sort its I/O stats into metadata and data
+    super_t super; readSuperBlock(&super); disk->setLayout(super);
+}
+
+// FNV-1a, continuing from a previous hash so data can be fed in pieces
+static unsigned long long fnv1a(unsigned long long hash, const void *data, int size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (int i = 0; i < size; i++) { hash ^= bytes[i]; hash *= 1099511628211ULL; }
+    return hash;
+}
+#define FNV1A_OFFSET_BASIS (14695981039346656037ULL)
+
+// XXH64, which takes 8 bytes at a time in four independent lanes and is much faster than FNV-1a on whole blocks
+#define XXH_PRIME64_1 (11400714785074694791ULL)
+#define XXH_PRIME64_2 (14029467366897019727ULL)
+#define XXH_PRIME64_3 (1609587929392839161ULL)
+#define XXH_PRIME64_4 (9650029242287828579ULL)
+#define XXH_PRIME64_5 (2870177450012600261ULL)
+static inline unsigned long long rotl64(unsigned long long x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline unsigned long long read64(const unsigned char *p) { unsigned long long v; memcpy(&v, p, 8); return v; }
+static inline unsigned long long xxh64Round(unsigned long long acc, unsigned long long input) {
+    acc += input * XXH_PRIME64_2; return rotl64(acc, 31) * XXH_PRIME64_1;
+}
+static inline unsigned long long xxh64Merge(unsigned long long acc, unsigned long long lane) {
+    acc ^= xxh64Round(0, lane); return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+static unsigned long long xxh64(const void *data, size_t size, unsigned long long seed) {
+    const unsigned char *p = (const unsigned char *)data, *end = p + size; unsigned long long hash;
+    if (size >= 32) {
+        unsigned long long v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2, v2 = seed + XXH_PRIME64_2, v3 = seed, v4 = seed - XXH_PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64Round(v1, read64(p)); v2 = xxh64Round(v2, read64(p + 8));
+            v3 = xxh64Round(v3, read64(p + 16)); v4 = xxh64Round(v4, read64(p + 24));
+        }
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh64Merge(hash, v1); hash = xxh64Merge(hash, v2); hash = xxh64Merge(hash, v3); hash = xxh64Merge(hash, v4);
+    } else { hash = seed + XXH_PRIME64_5; }
+    hash += size;
+    for (; p + 8 <= end; p += 8) { hash ^= xxh64Round(0, read64(p)); hash = rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4; }
+    if (p + 4 <= end) { unsigned int v; memcpy(&v, p, 4); hash ^= v * XXH_PRIME64_1; hash = rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3; p += 4; }
+    for (; p < end; p++) { hash ^= *p * XXH_PRIME64_5; hash = rotl64(hash, 11) * XXH_PRIME64_1; }
+    hash ^= hash >> 33; hash *= XXH_PRIME64_2; hash ^= hash >> 29; hash *= XXH_PRIME64_3; hash ^= hash >> 32;
+    return hash;
+}
 
 void LocalFileSystem::readSuperBlock(super_t *super) {
+    TraceSpan span(TRACE_SUPERBLOCK);
     
     // Copy the contents of the super block into a buffer
     char buffer[UFS_BLOCK_SIZE]; disk->readBlock(0, buffer);
@@ -44,6 +94,7 @@ void LocalFileSystem::readSuperBlock(super_t *super) {
 }
 
 int LocalFileSystem::lookup(int parentInodeNumber, string name) {
+    TraceSpan span(TRACE_LOOKUP, parentInodeNumber);
     
     /**
      * Lookup an inode.
@@ -71,7 +122,7 @@ int LocalFileSystem::lookup(int parentInodeNumber, string name) {
     char buffer[parent.size]; read(parentInodeNumber, buffer, parent.size);
     
     // Check every entry in the contents to find a match
-    for (int i = 0; i < (parent.size / sizeof(dir_ent_t)); i++) {
+    for (int i = 0; i < (int)(parent.size / sizeof(dir_ent_t)); i++) {
         
         // Copy the entry from the buffer into an entry object
         dir_ent_t entry; memcpy(&entry, buffer + i * sizeof(dir_ent_t), sizeof(dir_ent_t));
@@ -139,30 +190,35 @@ int LocalFileSystem::read(int inodeNumber, void *buffer, int size) {
     // Get the inode using the inodeNumber and return if it is valid
     inode_t inode; int EVALUE; if ((EVALUE = stat(inodeNumber, &inode)) < 0) { return EVALUE; }
 
-    // Adjust the size to stay within the bounds of the contents; Define variables for reading through data
-    size = min(size, inode.size); int bytesToRead = size; int bytesRead = 0; char readBuffer[UFS_BLOCK_SIZE];
+    return readAt(&inode, 0, buffer, size); /* Return number of bytes read */
     
-    // Read blocks from the inode contents as long as there are still bytes to read
-    for (int i = 0; bytesToRead > 0; i++) {
-        
-        // If there are more bytes to read than the block size, read only up to the block size
-        int readBytes = min(bytesToRead, UFS_BLOCK_SIZE);
-        
+}
+
+int LocalFileSystem::readAt(inode_t *inode, int offset, void *buffer, int size) {
+
+    // Bounds Check: Reject negative ranges and clip the range to the end of the inode
+    if (offset < 0 || size < 0) { return -EINVALIDSIZE; }
+    if (offset >= inode->size) { return 0; }
+    size = min(size, inode->size - offset); int bytesRead = 0; char readBuffer[UFS_BLOCK_SIZE];
+
+    // Read only the blocks that overlap the range, starting part way into the first one
+    for (int i = offset / UFS_BLOCK_SIZE, skip = offset % UFS_BLOCK_SIZE; bytesRead < size; i++, skip = 0) {
+
         // Copy the block from the disk into the buffer for reading
-        disk->readBlock(inode.direct[i], readBuffer);
-        
-        // Copy the bytes from the reading buffer to the return buffer
-        memcpy((char*)buffer + bytesRead, readBuffer, readBytes);
-        
-        // Increment and decrement variables for reading through data
-        bytesRead += readBytes; bytesToRead -= readBytes;
+        disk->readBlock(inode->direct[i], readBuffer);
+
+        // Copy the wanted bytes from the reading buffer to the return buffer
+        int readBytes = min(size - bytesRead, UFS_BLOCK_SIZE - skip);
+        memcpy((char*)buffer + bytesRead, readBuffer + skip, readBytes);
+        bytesRead += readBytes;
     }
 
     return size; /* Return number of bytes read */
-    
+
 }
 
 int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
+    TraceSpan span(TRACE_CREATE, parentInodeNumber);
   
     /**
      * Makes a file or directory.
@@ -264,12 +320,13 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
     memcpy(&inodes[inodeNumber], &inode, sizeof(inode_t));
     writeInodeRegion(&super, inodes);
 
-    return inodeNumber;   /* Terminate Successfully */
+    newGeneration(inodeNumber); return inodeNumber;   /* Terminate Successfully */
     
 }
 
 
 int LocalFileSystem::write(int inodeNumber, const void *buffer, int size) {
+    TraceSpan span(TRACE_WRITE, inodeNumber);
 
     /**
      * Write the contents of a file.
@@ -283,8 +340,15 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size) {
      * (because you can't write to directories).
      */
 
-    // Read in the Super block
-    super_t super; readSuperBlock(&super);
+    // A whole-buffer write is a streaming write with a single append
+    WriteStream stream; int EVALUE;
+    if ((EVALUE = beginWrite(inodeNumber, size, &stream)) < 0) { return EVALUE; }
+    if ((EVALUE = appendWrite(&stream, buffer, size)) < 0) { return EVALUE; }
+    return endWrite(&stream);
+
+}
+
+int LocalFileSystem::beginWrite(int inodeNumber, int size, WriteStream *stream) {
 
     // Check if the inodeNumber is Valid
     inode_t inode; int EVALUE; if ((EVALUE = stat(inodeNumber, &inode)) < 0) { return EVALUE; }
@@ -295,65 +359,203 @@ int LocalFileSystem::write(int inodeNumber, const void *buffer, int size) {
     // Check if the entry type is valid (is a directory)
     if (inode.type != UFS_REGULAR_FILE) { return -EWRITETODIR; }
 
+    // Get the available data blocks, the old contents stay intact until endWrite
+    if ((EVALUE = chooseBlocks(size, stream)) < 0) { return EVALUE; }
+    if (deduplicate) { loadSharedBlocks(&stream->super); }
+
+    // Remember where the write is going
+    stream->inodeNumber = inodeNumber; stream->inode = inode; stream->staged.clear();
+
+    return 0; /* Ready for Data */
+
+}
+
+// Picks free data blocks for size bytes and sets the stream up to take them
+int LocalFileSystem::chooseBlocks(int size, WriteStream *stream) {
+
+    // Read in the Super block
+    super_t super; readSuperBlock(&super);
+
     // Calculate the number of blocks needed
     int blocksNeeded = (size / UFS_BLOCK_SIZE) + (size % UFS_BLOCK_SIZE ? 1 : 0);
     
     // Load in the data bitmap
-    unsigned char dataBitmap[(UFS_BLOCK_SIZE * super.data_bitmap_len)]; readDataBitmap(&super, dataBitmap);
+    stream->dataBitmap.resize(UFS_BLOCK_SIZE * super.data_bitmap_len); readDataBitmap(&super, stream->dataBitmap.data());
+    unsigned char *dataBitmap = stream->dataBitmap.data();
 
     // Get the available data blocks
-    vector<int> availableBlocks;
+    stream->blocks.clear();
     for (int i = 0; i < super.num_data && blocksNeeded > 0; i++) {
-        if (!((dataBitmap[i / 8] >> (i % 8)) & 1)) { availableBlocks.push_back(i); blocksNeeded--; }
+        if (!((dataBitmap[i / 8] >> (i % 8)) & 1)) { stream->blocks.push_back(i); blocksNeeded--; }
     }   if (blocksNeeded > 0) { return -ENOTENOUGHSPACE; }
+
+    // Every block starts out as a new one of its own, deduplication may swap some for blocks already in use
+    stream->reused.assign(stream->blocks.size(), false); stream->fingerprints.assign(stream->blocks.size(), 0);
+
+    stream->size = size; stream->written = 0; stream->super = super;
+    stream->hash = FNV1A_OFFSET_BASIS; stream->unchanged = false;
+
+    return 0;
+
+}
+
+int LocalFileSystem::appendWrite(WriteStream *stream, const void *buffer, int size) {
+
+    // The caller promised exactly stream->size bytes in beginWrite
+    if (size < 0 || size > stream->size - stream->written) { return -EINVALIDSIZE; }
+    bool last = size > 0 && stream->written + size == stream->size;
+
+    // Copy the data into the current block, writing each block out once it is full
+    const char *data = (const char *)buffer; stream->hash = fnv1a(stream->hash, buffer, size);
+    while (size > 0) {
+        int blockOffset = stream->written % UFS_BLOCK_SIZE;
+        int copyBytes = min(size, UFS_BLOCK_SIZE - blockOffset);
+        memcpy(stream->block + blockOffset, data, copyBytes);
+        stream->written += copyBytes; data += copyBytes; size -= copyBytes;
+
+        if (blockOffset + copyBytes == UFS_BLOCK_SIZE) { storeBlock(stream, (stream->written - 1) / UFS_BLOCK_SIZE); }
+    }
+
+    // The last partial block goes out with the last byte, padded with zeros
+    int blockOffset = stream->written % UFS_BLOCK_SIZE;
+    if (last && blockOffset != 0) {
+        memset(stream->block + blockOffset, 0, UFS_BLOCK_SIZE - blockOffset);
+        storeBlock(stream, stream->blocks.size() - 1);
+    }
+
+    return 0; /* Data Accepted */
+
+}
+
+int LocalFileSystem::endWrite(WriteStream *stream) {
+    TraceSpan span(TRACE_WRITE, stream->inodeNumber);
+
+    // All of the bytes announced in beginWrite must have arrived
+    if (stream->written != stream->size) { return -EINVALIDSIZE; }
+
+    return finishWrite(stream);
+
+}
+
+int LocalFileSystem::stageWrite(int size, WriteStream *stream) {
+
+    // Check if the Size is Valid
+    if (size < 0 || size > MAX_FILE_SIZE) { return -EINVALIDSIZE; }
+
+    // Mark the blocks in use straight away, so nothing else takes them while the data comes in
+    int EVALUE; if ((EVALUE = chooseBlocks(size, stream)) < 0) { return EVALUE; }
+    unsigned char *dataBitmap = stream->dataBitmap.data();
+    for (size_t i = 0; i < stream->blocks.size(); i++) { dataBitmap[stream->blocks[i] / 8] |= 1 << (stream->blocks[i] % 8); }
+    if (!stream->blocks.empty()) { writeDataBitmap(&stream->super, dataBitmap); }
+
+    // There is no inode yet, commitWrite supplies it
+    stream->inodeNumber = -1; stream->staged = stream->blocks;
+
+    return 0; /* Ready for Data */
+
+}
+
+int LocalFileSystem::commitWrite(int inodeNumber, WriteStream *stream) {
+    TraceSpan span(TRACE_WRITE, inodeNumber);
+
+    // All of the bytes announced in stageWrite must have arrived
+    if (stream->written != stream->size) { return -EINVALIDSIZE; }
+
+    // Check the inode the same way beginWrite does
+    inode_t inode; int EVALUE; if ((EVALUE = stat(inodeNumber, &inode)) < 0) { return EVALUE; }
+    if (inode.type != UFS_REGULAR_FILE) { return -EWRITETODIR; }
+
+    // Anything may have changed while the data came in, so pick up the metadata as it is now. The staged
+    // blocks count as free in it again until the inode points at them, which gives back any it doesn't
+    readSuperBlock(&stream->super); readDataBitmap(&stream->super, stream->dataBitmap.data());
+    unsigned char *dataBitmap = stream->dataBitmap.data();
+    for (size_t i = 0; i < stream->staged.size(); i++) { dataBitmap[stream->staged[i] / 8] &= ~(1 << (stream->staged[i] % 8)); }
+    stream->inodeNumber = inodeNumber; stream->inode = inode;
+    if (deduplicate) { loadSharedBlocks(&stream->super); matchStagedBlocks(stream); }
+
+    // Unchanged contents leave the metadata alone, except to give the staged blocks back
+    int written = finishWrite(stream);
+    if (stream->unchanged && !stream->staged.empty()) { writeDataBitmap(&stream->super, dataBitmap); }
+
+    return written;
+
+}
+
+void LocalFileSystem::abortWrite(WriteStream *stream) {
+    if (stream->staged.empty()) { return; }
+
+    super_t super; readSuperBlock(&super);
+    vector<unsigned char> dataBitmap(UFS_BLOCK_SIZE * super.data_bitmap_len); readDataBitmap(&super, dataBitmap.data());
+    for (size_t i = 0; i < stream->staged.size(); i++) { dataBitmap[stream->staged[i] / 8] &= ~(1 << (stream->staged[i] % 8)); }
+    writeDataBitmap(&super, dataBitmap.data()); stream->staged.clear();
+}
+
+// Switches the stream's inode over to the blocks the data went to
+int LocalFileSystem::finishWrite(WriteStream *stream) {
+
+    // Rewriting a file with what it already holds doesn't need to touch the metadata. Only a hash that is already
+    // known is compared, so this never reads the whole old file just to find out, and a match is confirmed byte for byte
+    map<int, InodeVersion>::iterator known = versions.find(stream->inodeNumber);
+    if (stream->inode.size == stream->size && known != versions.end() && known->second.hashKnown && known->second.hash == stream->hash &&
+        sameContents(stream)) {
+        stream->unchanged = true; return stream->written;
+    }
+
+    super_t *super = &stream->super; inode_t inode = stream->inode;
+    unsigned char *dataBitmap = stream->dataBitmap.data(); char blockBuffer[UFS_BLOCK_SIZE];
     
-    // Define Variables for writing data to the buffer
-    int bytesToWrite = size, bytesWritten = 0; char blockBuffer[UFS_BLOCK_SIZE];
-    
-    // Delete the blocks in the direct table from the data bitmap
+    // Count the references to blocks that were already in use first, the old contents may be among them
+    for (int i = 0; i < (int)stream->blocks.size(); i++) {
+        if (stream->reused[i]) { loadSharedBlocks(super); sharedBlocks[stream->blocks[i] + super->data_region_addr]++; }
+    }
+
+    // Let go of the blocks in the direct table, freeing any no other file points at
     for (int i = 0; i < DIRECT_PTRS; i++) { if (inode.direct[i] != 0){
-        int dataBlockNumber = inode.direct[i] - super.data_region_addr;
-        dataBitmap[dataBlockNumber / 8] &= ~(1 << (dataBlockNumber % 8)); inode.direct[i] = 0;
+        releaseBlock(super, dataBitmap, inode.direct[i]); inode.direct[i] = 0;
     }}
     
-    // Write data from the buffer into direct table
-    for (int i = 0; i < (int)availableBlocks.size(); i++) {
-        
-        // Get the number of bytes to write at the current iteration
-        int writeBytes = min(bytesToWrite, UFS_BLOCK_SIZE);
-        
-        // Copy the data from the data buffer into a local block buffer
-        memcpy(blockBuffer, ((char*)buffer + (i * UFS_BLOCK_SIZE)), writeBytes);
-        
-        // Write the block buffer back to the disk
-        inode.direct[i] = availableBlocks[i] + super.data_region_addr;
-        disk->writeBlock(inode.direct[i], blockBuffer);
-        
-        // Update the variables used for writing data
-        bytesToWrite -= writeBytes; bytesWritten += writeBytes;
-        
-        // Update the data bitmap
-        dataBitmap[availableBlocks[i] / 8] |= 1 << (availableBlocks[i] % 8);
-      
-    }   inode.size = size; /* Update the size of the inode */
+    // Point the direct table at the new blocks and mark the ones that weren't in use yet in the data bitmap
+    for (int i = 0; i < (int)stream->blocks.size(); i++) {
+        inode.direct[i] = stream->blocks[i] + super->data_region_addr;
+        if (stream->reused[i]) { continue; }
+        dataBitmap[stream->blocks[i] / 8] |= 1 << (stream->blocks[i] % 8);
+        if (deduplicate) { rememberFingerprint(stream->fingerprints[i], inode.direct[i]); }
+    }   inode.size = stream->size; /* Update the size of the inode */
     
     // Write the data bitmap back to the disk
-    writeDataBitmap(&super, dataBitmap);
+    writeDataBitmap(super, dataBitmap);
     
     // Calculate the Location of the Inode in the Inode Region
     int numInodes = UFS_BLOCK_SIZE / sizeof(inode_t);
-    int inodeBlockNumber = inodeNumber / numInodes, inodeBlockOffset = inodeNumber % numInodes;
+    int inodeBlockNumber = stream->inodeNumber / numInodes, inodeBlockOffset = stream->inodeNumber % numInodes;
     
     // Read the Inode Block, Update it, then Write it Back to Disk
-    disk->readBlock((super.inode_region_addr + inodeBlockNumber), blockBuffer);
+    disk->readBlock((super->inode_region_addr + inodeBlockNumber), blockBuffer);
     memcpy((blockBuffer + (inodeBlockOffset * sizeof(inode_t))), &inode, sizeof(inode_t));
-    disk->writeBlock((super.inode_region_addr + inodeBlockNumber), blockBuffer);
+    disk->writeBlock((super->inode_region_addr + inodeBlockNumber), blockBuffer);
 
-    return bytesWritten; /* Terminate Successfully */
+    // The contents changed, so remember their hash under a new generation
+    newGeneration(stream->inodeNumber);
+    InodeVersion &version = versions[stream->inodeNumber]; version.hashKnown = true; version.hash = stream->hash;
 
+    return stream->written; /* Terminate Successfully */
+
+}
+
+// Compares the blocks a write just stored with the file's old blocks, over the file's size
+bool LocalFileSystem::sameContents(WriteStream *stream) {
+    char oldBlock[UFS_BLOCK_SIZE], newBlock[UFS_BLOCK_SIZE];
+    for (int i = 0; i < (int)stream->blocks.size(); i++) {
+        int newAddress = stream->blocks[i] + stream->super.data_region_addr, bytes = min((int)UFS_BLOCK_SIZE, stream->size - i * UFS_BLOCK_SIZE);
+        if (newAddress == (int)stream->inode.direct[i]) { continue; } /* Deduplication handed back the old block itself */
+        disk->readBlock(stream->inode.direct[i], oldBlock); disk->readBlock(newAddress, newBlock);
+        if (memcmp(oldBlock, newBlock, bytes) != 0) { return false; }
+    }
+    return true;
 }
 
 int LocalFileSystem::unlink(int parentInodeNumber, string name) {
+    TraceSpan span(TRACE_UNLINK, parentInodeNumber);
     
     /**
      * Remove a file or directory.
@@ -405,10 +607,9 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
     unsigned char dataBitmap[UFS_BLOCK_SIZE * super.data_bitmap_len];
     readDataBitmap(&super, dataBitmap);
     
-    // Remove the data blocks from the data bitmap
+    // Remove the data blocks from the data bitmap, unless another file still points at them
     for (int i = 0; i < DIRECT_PTRS; i++) { if (inode.direct[i] != 0) {
-        int j = inode.direct[i] - super.data_region_addr; int byteIndex = (j / 8), bitIndex = (j % 8);
-        dataBitmap[byteIndex] &= ~(1 << bitIndex); inode.direct[i] = 0;
+        releaseBlock(&super, dataBitmap, inode.direct[i]); inode.direct[i] = 0;
     }}  inode.size = 0;
     
     // Remove the inode from the inode bitmap
@@ -477,12 +678,423 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
     
     // Update the parent inode
     inodes[parentInodeNumber] = parent; writeInodeRegion(&super, inodes);
+
+    // The inode number is free to be reused, so its old contents must not look current
+    newGeneration(inodeNumber);
     
     return 0; /* Successful Termination */
-    
+
 }
 
+int LocalFileSystem::rename(int srcParentInodeNumber, string srcName, int dstParentInodeNumber, string dstName) {
+    TraceSpan span(TRACE_RENAME, srcParentInodeNumber);
 
+    /**
+     * Move a file or directory.
+     *
+     * Moves the entry srcName in directory srcParentInodeNumber to dstName
+     * in directory dstParentInodeNumber. Only directory entries change, the
+     * inode and its data blocks stay where they are. An existing entry at
+     * the destination is replaced if it is of the same type, and for a
+     * directory only if it is empty.
+     *
+     * Success: 0
+     * Failure: -EINVALIDINODE, -ENOTFOUND, -EINVALIDNAME, -EINVALIDTYPE,
+     *          -EDIRNOTEMPTY, -ENOTENOUGHSPACE, -EUNLINKNOTALLOWED, -EINVALIDMOVE
+     */
+
+    // Check that both names are valid and neither is '.' or '..'
+    for (const string *name : { &srcName, &dstName }) {
+        if (name->length() <= 0 || name->length() >= DIR_ENT_NAME_SIZE) { return -EINVALIDNAME; }
+        if (*name == "." || *name == "..") { return -EUNLINKNOTALLOWED; }
+    }
+
+    // Both parents have to be directories
+    super_t super; readSuperBlock(&super); inode_t srcParent, dstParent, inode, existingInode;
+    if (stat(srcParentInodeNumber, &srcParent) < 0 || srcParent.type != UFS_DIRECTORY) { return -EINVALIDINODE; }
+    if (stat(dstParentInodeNumber, &dstParent) < 0 || dstParent.type != UFS_DIRECTORY) { return -EINVALIDINODE; }
+
+    // Find what is being moved and whatever it would replace
+    int inodeNumber = lookup(srcParentInodeNumber, srcName);
+    if (inodeNumber < 0) { return inodeNumber; }
+    if (stat(inodeNumber, &inode) < 0) { return -EINVALIDINODE; }
+    int existing = lookup(dstParentInodeNumber, dstName);
+    if (existing == inodeNumber) { return 0; } /* Moving an entry onto itself changes nothing */
+    if (existing >= 0) {
+        if (stat(existing, &existingInode) < 0) { return -EINVALIDINODE; }
+        if (existingInode.type != inode.type) { return -EINVALIDTYPE; }
+        if (existingInode.type == UFS_DIRECTORY && (long unsigned int)existingInode.size > (2 * sizeof(dir_ent_t))) { return -EDIRNOTEMPTY; }
+    }
+
+    // A directory can't go anywhere below itself, so walk up from the destination to the root
+    if (inode.type == UFS_DIRECTORY) {
+        for (int dir = dstParentInodeNumber, steps = 0; steps < super.num_inodes; steps++) {
+            if (dir == inodeNumber) { return -EINVALIDMOVE; }
+            if (dir == UFS_ROOT_DIRECTORY_INODE_NUMBER) { break; }
+            if ((dir = lookup(dir, "..")) < 0) { return -EINVALIDINODE; }
+        }
+    }
+
+    // Everything below works on the inode table in memory and writes it back once at the end
+    inode_t inodes[super.num_inodes]; readInodeRegion(&super, inodes);
+    inode_t *from = &inodes[srcParentInodeNumber], *to = &inodes[dstParentInodeNumber];
+    unsigned char dataBitmap[UFS_BLOCK_SIZE * super.data_bitmap_len]; readDataBitmap(&super, dataBitmap);
+    bool dataBitmapChanged = false; dir_ent_t entry;
+    int position = entryIndex(from, srcName);
+
+    // Renaming within a directory just rewrites the entry's name
+    if (existing < 0 && from == to) {
+        readEntry(from, position, &entry); memset(entry.name, 0, DIR_ENT_NAME_SIZE);
+        strcpy(entry.name, dstName.c_str()); writeEntry(from, position, &entry);
+        return 0;
+    }
+
+    // Replace the entry at the destination, freeing whatever it pointed at
+    if (existing >= 0) {
+        int target = entryIndex(to, dstName); readEntry(to, target, &entry);
+        entry.inum = inodeNumber; writeEntry(to, target, &entry);
+
+        unsigned char inodeBitmap[UFS_BLOCK_SIZE * super.inode_bitmap_len]; readInodeBitmap(&super, inodeBitmap);
+        for (int i = 0; i < DIRECT_PTRS; i++) { if (existingInode.direct[i] != 0) {
+            releaseBlock(&super, dataBitmap, existingInode.direct[i]);
+        }}  inodeBitmap[existing / 8] &= ~(1 << (existing % 8)); writeInodeBitmap(&super, inodeBitmap);
+        memset(&inodes[existing], 0, sizeof(inode_t)); newGeneration(existing); dataBitmapChanged = true;
+    }
+
+    // Otherwise append a new entry, starting a new block if the last one is full
+    else {
+        int blockNumber = to->size / UFS_BLOCK_SIZE;
+        if (to->size % UFS_BLOCK_SIZE == 0) {
+            if (to->size + UFS_BLOCK_SIZE > MAX_FILE_SIZE) { return -ENOTENOUGHSPACE; }
+            int block = -1;
+            for (int i = 0; i < super.num_data && block < 0; i++) { if (!((dataBitmap[i / 8] >> (i % 8)) & 1)) { block = i; } }
+            if (block < 0) { return -ENOTENOUGHSPACE; }
+            dataBitmap[block / 8] |= 1 << (block % 8); to->direct[blockNumber] = block + super.data_region_addr; dataBitmapChanged = true;
+        }
+        entry.inum = inodeNumber; memset(entry.name, 0, DIR_ENT_NAME_SIZE); strcpy(entry.name, dstName.c_str());
+        to->size += sizeof(dir_ent_t); writeEntry(to, to->size / sizeof(dir_ent_t) - 1, &entry);
+    }
+
+    // Remove the source entry by moving the directory's last entry into its slot
+    if (from == to) { position = entryIndex(from, srcName); }
+    int last = from->size / sizeof(dir_ent_t) - 1;
+    if (position != last) { readEntry(from, last, &entry); writeEntry(from, position, &entry); }
+    from->size -= sizeof(dir_ent_t);
+
+    // Give back the last block if that emptied it
+    if (from->size % UFS_BLOCK_SIZE == 0) {
+        int blockNumber = from->size / UFS_BLOCK_SIZE, j = from->direct[blockNumber] - super.data_region_addr;
+        dataBitmap[j / 8] &= ~(1 << (j % 8)); from->direct[blockNumber] = 0; dataBitmapChanged = true;
+    }
+
+    // A directory that changed parents has to point its '..' entry at the new one
+    if (inode.type == UFS_DIRECTORY && from != to) {
+        readEntry(&inodes[inodeNumber], 1, &entry); entry.inum = dstParentInodeNumber; writeEntry(&inodes[inodeNumber], 1, &entry);
+    }
+
+    // Write the metadata back to the disk
+    if (dataBitmapChanged) { writeDataBitmap(&super, dataBitmap); }
+    writeInodeRegion(&super, inodes);
+
+    return 0; /* Successful Termination */
+
+}
+
+int LocalFileSystem::copy(int srcInodeNumber, int dstInodeNumber) {
+    TraceSpan span(TRACE_COPY, dstInodeNumber);
+
+    /**
+     * Copy a file's contents into another file.
+     *
+     * Replaces the contents of dstInodeNumber with those of srcInodeNumber,
+     * sharing the source's data blocks instead of copying them.
+     *
+     * Success: the size of the copy in bytes
+     * Failure: -EINVALIDINODE, -EINVALIDTYPE.
+     */
+
+    // Both ends have to be regular files
+    inode_t source, target; int EVALUE;
+    if ((EVALUE = stat(srcInodeNumber, &source)) < 0) { return EVALUE; }
+    if ((EVALUE = stat(dstInodeNumber, &target)) < 0) { return EVALUE; }
+    if (source.type != UFS_REGULAR_FILE || target.type != UFS_REGULAR_FILE) { return -EINVALIDTYPE; }
+    if (srcInodeNumber == dstInodeNumber) { return source.size; }
+
+    // Count the new references before letting go of the old ones, the two files may already share blocks
+    super_t super; readSuperBlock(&super); loadSharedBlocks(&super);
+    for (int i = 0; i < DIRECT_PTRS; i++) { if (source.direct[i] != 0) { sharedBlocks[source.direct[i]]++; } }
+    unsigned char dataBitmap[UFS_BLOCK_SIZE * super.data_bitmap_len]; readDataBitmap(&super, dataBitmap);
+    bool dataBitmapChanged = false;
+    for (int i = 0; i < DIRECT_PTRS; i++) { if (target.direct[i] != 0) {
+        dataBitmapChanged |= releaseBlock(&super, dataBitmap, target.direct[i]);
+    }}
+    if (dataBitmapChanged) { writeDataBitmap(&super, dataBitmap); }
+
+    // Point the destination at the source's blocks
+    inode_t inodes[super.num_inodes]; readInodeRegion(&super, inodes);
+    memcpy(inodes[dstInodeNumber].direct, source.direct, sizeof(source.direct));
+    inodes[dstInodeNumber].size = source.size; writeInodeRegion(&super, inodes);
+
+    // The destination has new contents, which hash the same as the source's. The hash is only carried over if it is
+    // already known, working it out here would read every block the copy was meant to share
+    newGeneration(dstInodeNumber);
+    map<int, InodeVersion>::iterator known = versions.find(srcInodeNumber);
+    if (known != versions.end() && known->second.hashKnown) { InodeVersion &version = versions[dstInodeNumber]; version.hashKnown = true; version.hash = known->second.hash; }
+
+    return source.size; /* Terminate Successfully */
+
+}
+
+int LocalFileSystem::snapshot(string name) {
+
+    /**
+     * Take a snapshot of the whole file system.
+     *
+     * Makes /.snapshots/name a copy of everything else under the root,
+     * with files sharing their data blocks with the originals.
+     *
+     * Success: the inode number of the snapshot's directory
+     * Failure: -EINVALIDNAME, -ESNAPSHOTEXISTS, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+     */
+
+    // Check the name before creating anything
+    if (name.length() <= 0 || name.length() >= DIR_ENT_NAME_SIZE) { return -EINVALIDNAME; }
+    if (name == "." || name == "..") { return -EINVALIDNAME; }
+
+    // Find or make the directory snapshots live in, and a directory in it for this one
+    int snapshots = create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_DIRECTORY, SNAPSHOT_DIRECTORY);
+    if (snapshots < 0) { return snapshots; }
+    if (lookup(snapshots, name) >= 0) { return -ESNAPSHOTEXISTS; }
+    int root = create(snapshots, UFS_DIRECTORY, name);
+    if (root < 0) { return root; }
+
+    // Copy the tree into it
+    int EVALUE; if ((EVALUE = copyTree(UFS_ROOT_DIRECTORY_INODE_NUMBER, root)) < 0) { return EVALUE; }
+    return root; /* Terminate Successfully */
+
+}
+
+int LocalFileSystem::removeSnapshot(string name) {
+
+    /**
+     * Remove a snapshot taken with snapshot().
+     *
+     * Success: 0
+     * Failure: -EINVALIDNAME, -ENOTFOUND, and the failures of unlink().
+     */
+
+    if (name.length() <= 0 || name.length() >= DIR_ENT_NAME_SIZE) { return -EINVALIDNAME; }
+    if (name == "." || name == "..") { return -EINVALIDNAME; }
+
+    // Find the snapshot, then remove everything in it from the bottom up
+    int snapshots = lookup(UFS_ROOT_DIRECTORY_INODE_NUMBER, SNAPSHOT_DIRECTORY);
+    if (snapshots < 0 || lookup(snapshots, name) < 0) { return -ENOTFOUND; }
+    return removeTree(snapshots, name);
+
+}
+
+// The entries of a directory other than '.' and '..'
+int LocalFileSystem::readEntries(int inodeNumber, vector<dir_ent_t> *entries) {
+    inode_t inode; int EVALUE; if ((EVALUE = stat(inodeNumber, &inode)) < 0) { return EVALUE; }
+    if (inode.type != UFS_DIRECTORY) { return -EINVALIDTYPE; }
+    vector<dir_ent_t> all(inode.size / sizeof(dir_ent_t)); readAt(&inode, 0, all.data(), all.size() * sizeof(dir_ent_t));
+    entries->clear();
+    for (size_t i = 0; i < all.size(); i++) {
+        if (strcmp(all[i].name, ".") != 0 && strcmp(all[i].name, "..") != 0) { entries->push_back(all[i]); }
+    }
+    return 0;
+}
+
+// Recreates everything in directory srcInodeNumber inside dstInodeNumber, sharing file contents.
+// Snapshots are left out of a copy of the root
+int LocalFileSystem::copyTree(int srcInodeNumber, int dstInodeNumber) {
+    vector<dir_ent_t> entries; int EVALUE;
+    if ((EVALUE = readEntries(srcInodeNumber, &entries)) < 0) { return EVALUE; }
+    for (size_t i = 0; i < entries.size(); i++) {
+        string name(entries[i].name, strnlen(entries[i].name, DIR_ENT_NAME_SIZE));
+        if (srcInodeNumber == UFS_ROOT_DIRECTORY_INODE_NUMBER && name == SNAPSHOT_DIRECTORY) { continue; }
+
+        inode_t inode; if ((EVALUE = stat(entries[i].inum, &inode)) < 0) { return EVALUE; }
+        int copyInodeNumber = create(dstInodeNumber, inode.type, name);
+        if (copyInodeNumber < 0) { return copyInodeNumber; }
+        EVALUE = inode.type == UFS_DIRECTORY ? copyTree(entries[i].inum, copyInodeNumber) : copy(entries[i].inum, copyInodeNumber);
+        if (EVALUE < 0) { return EVALUE; }
+    }
+    return 0;
+}
+
+// Unlinks name from its parent, first emptying it if it is a directory
+int LocalFileSystem::removeTree(int parentInodeNumber, const string &name) {
+    int inodeNumber = lookup(parentInodeNumber, name); if (inodeNumber < 0) { return inodeNumber; }
+    vector<dir_ent_t> entries; int EVALUE;
+    if (readEntries(inodeNumber, &entries) == 0) {
+        for (size_t i = 0; i < entries.size(); i++) {
+            string entryName(entries[i].name, strnlen(entries[i].name, DIR_ENT_NAME_SIZE));
+            if ((EVALUE = removeTree(inodeNumber, entryName)) < 0) { return EVALUE; }
+        }
+    }
+    return unlink(parentInodeNumber, name);
+}
+
+// Counts how many inodes point at each data block, keeping the ones with more than one. With deduplication on
+// it also hashes every file block the first time, and after a rollback drops the hashes of blocks no file has now
+void LocalFileSystem::loadSharedBlocks(super_t *super) {
+    bool stale = !sharedBlocksLoaded || sharedBlocksRollbacks != disk->rollbacks();
+    if (!stale && (fingerprintsLoaded || !deduplicate)) { return; }
+
+    unsigned char inodeBitmap[UFS_BLOCK_SIZE * super->inode_bitmap_len]; readInodeBitmap(super, inodeBitmap);
+    inode_t inodes[super->num_inodes]; readInodeRegion(super, inodes);
+    vector<int> references(super->num_data, 0); vector<bool> fileBlocks(super->num_data, false);
+    for (int i = 0; i < super->num_inodes; i++) { if ((inodeBitmap[i / 8] >> (i % 8)) & 1) {
+        for (int j = 0; j < DIRECT_PTRS; j++) {
+            int dataBlockNumber = (int)inodes[i].direct[j] - super->data_region_addr;
+            if (inodes[i].direct[j] == 0 || dataBlockNumber < 0 || dataBlockNumber >= super->num_data) { continue; }
+            references[dataBlockNumber]++; if (inodes[i].type == UFS_REGULAR_FILE) { fileBlocks[dataBlockNumber] = true; }
+        }
+    }}
+
+    sharedBlocks.clear();
+    for (int i = 0; i < super->num_data; i++) { if (references[i] > 1) { sharedBlocks[i + super->data_region_addr] = references[i] - 1; } }
+    sharedBlocksLoaded = true; sharedBlocksRollbacks = disk->rollbacks();
+
+    // Directory blocks change in place, so only file blocks can ever be shared by deduplication
+    unsigned char blockBuffer[UFS_BLOCK_SIZE];
+    if (deduplicate && !fingerprintsLoaded) {
+        for (int i = 0; i < super->num_data; i++) { if (fileBlocks[i]) {
+            disk->readBlock(i + super->data_region_addr, blockBuffer);
+            rememberFingerprint(xxh64(blockBuffer, UFS_BLOCK_SIZE, 0), i + super->data_region_addr);
+        }}
+        fingerprintsLoaded = true;
+    }
+    else if (fingerprintsLoaded) {
+        vector<int> gone;
+        for (map<int, unsigned long long>::iterator known = blockFingerprints.begin(); known != blockFingerprints.end(); known++) {
+            if (!fileBlocks[known->first - super->data_region_addr]) { gone.push_back(known->first); }
+        }
+        for (size_t i = 0; i < gone.size(); i++) { forgetFingerprint(gone[i]); }
+    }
+}
+
+void LocalFileSystem::setDeduplicate(bool deduplicate) {
+    this->deduplicate = deduplicate;
+
+    // Build the hash index now rather than inside whichever write happens to need it first
+    if (deduplicate) { super_t super; readSuperBlock(&super); loadSharedBlocks(&super); }
+    else { fingerprintBlocks.clear(); blockFingerprints.clear(); fingerprintsLoaded = false; }
+}
+
+// Writes the stream's current block out as the file's blockIndex'th block, or with deduplication on points
+// the file at a block that already holds the same bytes
+void LocalFileSystem::storeBlock(WriteStream *stream, int blockIndex) {
+    if (deduplicate) {
+        unsigned long long fingerprint = xxh64(stream->block, UFS_BLOCK_SIZE, 0); stream->fingerprints[blockIndex] = fingerprint;
+        int match = findBlock(stream, blockIndex, fingerprint);
+        if (match >= 0) { stream->blocks[blockIndex] = match; stream->reused[blockIndex] = true; return; }
+    }
+    int address = stream->blocks[blockIndex] + stream->super.data_region_addr;
+    if (stream->staged.empty()) { disk->writeBlock(address, stream->block); } else { disk->writeNewBlock(address, stream->block); }
+}
+
+// A data block with the same bytes as the stream's current block, either one this write has already filled
+// or one a file holds, or -1. Hashes only find candidates, the bytes decide
+int LocalFileSystem::findBlock(WriteStream *stream, int blockIndex, unsigned long long fingerprint) {
+    unsigned char blockBuffer[UFS_BLOCK_SIZE]; int dataRegion = stream->super.data_region_addr;
+    for (int i = 0; i < blockIndex; i++) { if (!stream->reused[i] && stream->fingerprints[i] == fingerprint) {
+        disk->readBlock(stream->blocks[i] + dataRegion, blockBuffer);
+        if (memcmp(blockBuffer, stream->block, UFS_BLOCK_SIZE) == 0) { return stream->blocks[i]; }
+    }}
+
+    // A staged write fills its blocks without the lock the index needs, commitWrite looks there instead
+    if (!stream->staged.empty()) { return -1; }
+    map<unsigned long long, int>::iterator known = fingerprintBlocks.find(fingerprint);
+    if (known == fingerprintBlocks.end()) { return -1; }
+    int dataBlockNumber = known->second - dataRegion;
+    if (!((stream->dataBitmap[dataBlockNumber / 8] >> (dataBlockNumber % 8)) & 1)) { return -1; }
+    disk->readBlock(known->second, blockBuffer);
+    return memcmp(blockBuffer, stream->block, UFS_BLOCK_SIZE) == 0 ? dataBlockNumber : -1;
+}
+
+// Points a staged write's blocks at blocks other files hold with the same bytes, the half of findBlock that
+// appendWrite skipped. Blocks the write matched against one that gets swapped follow it
+void LocalFileSystem::matchStagedBlocks(WriteStream *stream) {
+    unsigned char stagedBuffer[UFS_BLOCK_SIZE], blockBuffer[UFS_BLOCK_SIZE]; int dataRegion = stream->super.data_region_addr;
+    for (int i = 0; i < (int)stream->blocks.size(); i++) {
+        if (stream->reused[i]) { continue; }
+        map<unsigned long long, int>::iterator known = fingerprintBlocks.find(stream->fingerprints[i]);
+        if (known == fingerprintBlocks.end()) { continue; }
+        int dataBlockNumber = known->second - dataRegion;
+        if (!((stream->dataBitmap[dataBlockNumber / 8] >> (dataBlockNumber % 8)) & 1)) { continue; }
+        disk->readBlock(known->second, blockBuffer); disk->readBlock(stream->blocks[i] + dataRegion, stagedBuffer);
+        if (memcmp(blockBuffer, stagedBuffer, UFS_BLOCK_SIZE) != 0) { continue; }
+        int staged = stream->blocks[i];
+        for (int j = i; j < (int)stream->blocks.size(); j++) {
+            if (stream->blocks[j] == staged) { stream->blocks[j] = dataBlockNumber; stream->reused[j] = true; }
+        }
+    }
+}
+
+// Keeps the hash index one to one, a newer block with the same hash takes the place of the older one
+void LocalFileSystem::rememberFingerprint(unsigned long long fingerprint, int blockAddress) {
+    forgetFingerprint(blockAddress);
+    map<unsigned long long, int>::iterator known = fingerprintBlocks.find(fingerprint);
+    if (known != fingerprintBlocks.end()) { blockFingerprints.erase(known->second); }
+    fingerprintBlocks[fingerprint] = blockAddress; blockFingerprints[blockAddress] = fingerprint;
+}
+
+void LocalFileSystem::forgetFingerprint(int blockAddress) {
+    map<int, unsigned long long>::iterator known = blockFingerprints.find(blockAddress);
+    if (known == blockFingerprints.end()) { return; }
+    fingerprintBlocks.erase(known->second); blockFingerprints.erase(known);
+}
+
+// Drops one inode's reference to a data block, clearing it in the bitmap if that was the last one.
+// Returns whether the block was freed
+bool LocalFileSystem::releaseBlock(super_t *super, unsigned char *dataBitmap, int blockAddress) {
+    loadSharedBlocks(super);
+    map<int, int>::iterator shared = sharedBlocks.find(blockAddress);
+    if (shared != sharedBlocks.end()) {
+        if (--shared->second == 0) { sharedBlocks.erase(shared); }
+        return false;
+    }
+    int dataBlockNumber = blockAddress - super->data_region_addr;
+    dataBitmap[dataBlockNumber / 8] &= ~(1 << (dataBlockNumber % 8)); forgetFingerprint(blockAddress);
+    return true;
+}
+
+// Position of name among a directory's entries, or -ENOTFOUND
+int LocalFileSystem::entryIndex(inode_t *directory, const string &name) {
+    vector<char> buffer(directory->size); readAt(directory, 0, buffer.data(), directory->size);
+    for (int i = 0; i < (int)(directory->size / sizeof(dir_ent_t)); i++) {
+        const dir_ent_t *entry = reinterpret_cast<const dir_ent_t*>(buffer.data() + i * sizeof(dir_ent_t));
+        if (strncmp(entry->name, name.c_str(), DIR_ENT_NAME_SIZE) == 0) { return i; }
+    }
+    return -ENOTFOUND;
+}
+
+void LocalFileSystem::readEntry(inode_t *directory, int index, dir_ent_t *entry) {
+    char blockBuffer[UFS_BLOCK_SIZE]; int perBlock = UFS_BLOCK_SIZE / sizeof(dir_ent_t);
+    disk->readBlock(directory->direct[index / perBlock], blockBuffer);
+    memcpy(entry, blockBuffer + (index % perBlock) * sizeof(dir_ent_t), sizeof(dir_ent_t));
+}
+
+void LocalFileSystem::writeEntry(inode_t *directory, int index, const dir_ent_t *entry) {
+    char blockBuffer[UFS_BLOCK_SIZE]; int perBlock = UFS_BLOCK_SIZE / sizeof(dir_ent_t);
+    disk->readBlock(directory->direct[index / perBlock], blockBuffer);
+    memcpy(blockBuffer + (index % perBlock) * sizeof(dir_ent_t), entry, sizeof(dir_ent_t));
+    disk->writeBlock(directory->direct[index / perBlock], blockBuffer);
+}
+
+
+
+unsigned long long LocalFileSystem::generation(int inodeNumber) {
+    map<int, InodeVersion>::iterator version = versions.find(inodeNumber);
+    return version == versions.end() ? 0 : version->second.generation;
+}
+
+void LocalFileSystem::newGeneration(int inodeNumber) {
+    InodeVersion &version = versions[inodeNumber];
+    version.generation = ++lastGeneration; version.hashKnown = false;
+}
 
 bool LocalFileSystem::diskHasSpace(super_t *super, int numInodesNeeded, int numDataBytesNeeded, int numDataBlocksNeeded) {
 
@@ -537,6 +1149,7 @@ bool LocalFileSystem::diskHasSpace(super_t *super, int numInodesNeeded, int numD
 }
 
 void LocalFileSystem::readInodeBitmap(super_t *super, unsigned char *inodeBitmap) {
+    TraceSpan span(TRACE_INODE_BITMAP, 0);
     char buffer[UFS_BLOCK_SIZE];
     for (int i = 0; i < super->inode_bitmap_len; i++) {
         disk->readBlock((super->inode_bitmap_addr + i), buffer);
@@ -545,6 +1158,7 @@ void LocalFileSystem::readInodeBitmap(super_t *super, unsigned char *inodeBitmap
 }
 
 void LocalFileSystem::writeInodeBitmap(super_t *super, unsigned char *inodeBitmap) {
+    TraceSpan span(TRACE_INODE_BITMAP, 1);
     char buffer[UFS_BLOCK_SIZE];
     for (int i = 0; i < super->inode_bitmap_len; i++) {
         memcpy(buffer, (inodeBitmap + (i * UFS_BLOCK_SIZE)), UFS_BLOCK_SIZE);
@@ -553,6 +1167,7 @@ void LocalFileSystem::writeInodeBitmap(super_t *super, unsigned char *inodeBitma
 }
 
 void LocalFileSystem::readDataBitmap(super_t *super, unsigned char *dataBitmap) {
+    TraceSpan span(TRACE_DATA_BITMAP, 0);
     char buffer[UFS_BLOCK_SIZE];
     for (int i = 0; i < super->data_bitmap_len; i++) {
         disk->readBlock((super->data_bitmap_addr + i), buffer);
@@ -561,6 +1176,7 @@ void LocalFileSystem::readDataBitmap(super_t *super, unsigned char *dataBitmap)
 }
 
 void LocalFileSystem::writeDataBitmap(super_t *super, unsigned char *dataBitmap) {
+    TraceSpan span(TRACE_DATA_BITMAP, 1);
     char buffer[UFS_BLOCK_SIZE];
     for (int i = 0; i < super->data_bitmap_len; i++) {
         memcpy(buffer, (dataBitmap + (i * UFS_BLOCK_SIZE)), UFS_BLOCK_SIZE);
@@ -569,10 +1185,12 @@ void LocalFileSystem::writeDataBitmap(super_t *super, unsigned char *dataBitmap)
 }
 
 void LocalFileSystem::readInodeRegion(super_t *super, inode_t *inodes) {
+    TraceSpan span(TRACE_INODE_TABLE, 0);
     
-    // Calculate the total size of the inode region in bytes
+    // Calculate the total size of the inode region in bytes, the buffer holds whole blocks since
+    // the last one is only partly used when the inode count isn't a multiple of the inodes per block
     int inodeRegionSize = super->num_inodes * sizeof(inode_t);
-    char* buffer = new char[inodeRegionSize];
+    char* buffer = new char[super->inode_region_len * UFS_BLOCK_SIZE];
     
     // Read the inode region block by block
     int readSize = 0;
@@ -588,12 +1206,14 @@ void LocalFileSystem::readInodeRegion(super_t *super, inode_t *inodes) {
 }
 
 void LocalFileSystem::writeInodeRegion(super_t *super, inode_t *inodes) {
+    TraceSpan span(TRACE_INODE_TABLE, 1);
     
     // Calculate the total size of the inode region in bytes
     int inodeRegionSize = super->num_inodes * sizeof(inode_t);
-    char* buffer = new char[inodeRegionSize];
+    char* buffer = new char[super->inode_region_len * UFS_BLOCK_SIZE];
 
-    // Copy the inode data into a buffer
+    // Copy the inode data into a buffer, zeroing the unused tail of the last block
+    memset(buffer, 0, super->inode_region_len * UFS_BLOCK_SIZE);
     memcpy(buffer, inodes, inodeRegionSize);
     
     // Write the inode region block by block
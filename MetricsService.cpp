@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "MetricsService.h"
+#include "ClientError.h"
+#include "Trace.h"
+
+using namespace std;
+
+static const double latencyBounds[METRICS_LATENCY_BUCKETS] = METRICS_LATENCY_BOUNDS;
+static const char *methodNames[METRICS_METHOD_SLOTS - 1] = METRICS_METHODS;
+static const int statusCodes[METRICS_STATUS_SLOTS - 1] = METRICS_STATUSES;
+
+MetricsService::MetricsService(DistributedFileSystemService *dfs, FileService *files) : HttpService("/metrics") {
+  this->m_dfs = dfs;
+  this->m_files = files;
+  for (int method = 0; method < METRICS_METHOD_SLOTS; method++) {
+    for (int status = 0; status < METRICS_STATUS_SLOTS; status++) {
+      Histogram &histogram = m_requests[method][status];
+      for (int bucket = 0; bucket <= METRICS_LATENCY_BUCKETS; bucket++) {
+	histogram.buckets[bucket] = 0;
+      }
+      histogram.sumMicros = 0;
+    }
+  }
+}
+
+int MetricsService::methodSlot(const char *method) {
+  for (int slot = 0; slot < METRICS_METHOD_SLOTS - 1; slot++) {
+    if (strcmp(methodNames[slot], method) == 0) {
+      return slot;
+    }
+  }
+  return METRICS_METHOD_SLOTS - 1;
+}
+
+int MetricsService::statusSlot(int status) {
+  for (int slot = 0; slot < METRICS_STATUS_SLOTS - 1; slot++) {
+    if (statusCodes[slot] == status) {
+      return slot;
+    }
+  }
+  return METRICS_STATUS_SLOTS - 1;
+}
+
+void MetricsService::recordRequest(const char *method, int status, double seconds) {
+  Histogram &histogram = m_requests[methodSlot(method)][statusSlot(status)];
+  int bucket = 0;
+  while (bucket < METRICS_LATENCY_BUCKETS && seconds > latencyBounds[bucket]) {
+    bucket++;
+  }
+  histogram.buckets[bucket].fetch_add(1, memory_order_relaxed);
+  histogram.sumMicros.fetch_add((unsigned long long) (seconds * 1000000), memory_order_relaxed);
+}
+
+void MetricsService::addCounter(string name, string help, const atomic<unsigned long> *value) {
+  Export e = { name, help, value, NULL };
+  m_exports.push_back(e);
+}
+
+void MetricsService::addGauge(string name, string help, const atomic<int> *value) {
+  Export e = { name, help, NULL, value };
+  m_exports.push_back(e);
+}
+
+static void writeHeader(string *out, const char *name, const char *type, const char *help) {
+  out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+static void writeValue(string *out, const char *name, double value) {
+  char line[256];
+  snprintf(line, sizeof(line), "%s %.17g\n", name, value);
+  out->append(line);
+}
+
+// only combinations that have seen a request are written out
+void MetricsService::writeRequests(string *out) {
+  char line[256];
+  writeHeader(out, "gunrock_request_duration_seconds", "histogram", "Time from taking a connection off the queue to closing it.");
+  for (int method = 0; method < METRICS_METHOD_SLOTS; method++) {
+    for (int status = 0; status < METRICS_STATUS_SLOTS; status++) {
+      Histogram &histogram = m_requests[method][status];
+      unsigned long counts[METRICS_LATENCY_BUCKETS + 1];
+      unsigned long total = 0;
+      for (int bucket = 0; bucket <= METRICS_LATENCY_BUCKETS; bucket++) {
+	counts[bucket] = histogram.buckets[bucket].load(memory_order_relaxed);
+	total += counts[bucket];
+      }
+      if (total == 0) {
+	continue;
+      }
+
+      const char *methodName = method < METRICS_METHOD_SLOTS - 1 ? methodNames[method] : "other";
+      char statusName[16];
+      if (status < METRICS_STATUS_SLOTS - 1) {
+	snprintf(statusName, sizeof(statusName), "%d", statusCodes[status]);
+      } else {
+	snprintf(statusName, sizeof(statusName), "other");
+      }
+
+      unsigned long cumulative = 0;
+      for (int bucket = 0; bucket <= METRICS_LATENCY_BUCKETS; bucket++) {
+	cumulative += counts[bucket];
+	if (bucket < METRICS_LATENCY_BUCKETS) {
+	  snprintf(line, sizeof(line), "gunrock_request_duration_seconds_bucket{method=\"%s\",status=\"%s\",le=\"%g\"} %lu\n",
+		   methodName, statusName, latencyBounds[bucket], cumulative);
+	} else {
+	  snprintf(line, sizeof(line), "gunrock_request_duration_seconds_bucket{method=\"%s\",status=\"%s\",le=\"+Inf\"} %lu\n",
+		   methodName, statusName, cumulative);
+	}
+	out->append(line);
+      }
+      snprintf(line, sizeof(line), "gunrock_request_duration_seconds_sum{method=\"%s\",status=\"%s\"} %.6f\n",
+	       methodName, statusName, histogram.sumMicros.load(memory_order_relaxed) / 1000000.0);
+      out->append(line);
+      snprintf(line, sizeof(line), "gunrock_request_duration_seconds_count{method=\"%s\",status=\"%s\"} %lu\n",
+	       methodName, statusName, total);
+      out->append(line);
+    }
+  }
+}
+
+// per operation and region of the image, only the pairs that have seen I/O
+void MetricsService::writeDisk(string *out, const DiskStats &stats) {
+  char line[256];
+  writeHeader(out, "ds3_disk_ops_total", "counter", "Block reads and writes and fsyncs on the disk image.");
+  for (int op = 0; op < DISK_OPS; op++) {
+    for (int region = 0; region < DISK_REGIONS; region++) {
+      if (stats.ops[op][region] == 0) {
+	continue;
+      }
+      snprintf(line, sizeof(line), "ds3_disk_ops_total{op=\"%s\",region=\"%s\"} %lu\n",
+	       DiskStats::opName(op), DiskStats::regionName(region), stats.ops[op][region]);
+      out->append(line);
+    }
+  }
+
+  writeHeader(out, "ds3_disk_bytes_total", "counter", "Bytes moved to and from the disk image.");
+  for (int op = DISK_READ; op <= DISK_WRITE; op++) {
+    for (int region = 0; region < DISK_REGIONS; region++) {
+      if (stats.ops[op][region] == 0) {
+	continue;
+      }
+      snprintf(line, sizeof(line), "ds3_disk_bytes_total{op=\"%s\",region=\"%s\"} %llu\n",
+	       DiskStats::opName(op), DiskStats::regionName(region), stats.bytes[op][region]);
+      out->append(line);
+    }
+  }
+
+  writeHeader(out, "ds3_disk_undo_records_total", "counter", "Blocks saved to the undo log before being overwritten.");
+  writeValue(out, "ds3_disk_undo_records_total", stats.undoRecords);
+
+  writeHeader(out, "ds3_disk_latency_seconds", "histogram", "Time spent in each disk operation.");
+  for (int op = 0; op < DISK_OPS; op++) {
+    for (int region = 0; region < DISK_REGIONS; region++) {
+      if (stats.ops[op][region] == 0) {
+	continue;
+      }
+      const char *opName = DiskStats::opName(op), *regionName = DiskStats::regionName(region);
+      unsigned long cumulative = 0;
+      for (int bucket = 0; bucket < DISK_LATENCY_BUCKETS; bucket++) {
+	cumulative += stats.latency[op][region][bucket];
+	if (bucket < DISK_LATENCY_BUCKETS - 1) {
+	  snprintf(line, sizeof(line), "ds3_disk_latency_seconds_bucket{op=\"%s\",region=\"%s\",le=\"%g\"} %lu\n",
+		   opName, regionName, DiskStats::bucketBound(bucket), cumulative);
+	} else {
+	  snprintf(line, sizeof(line), "ds3_disk_latency_seconds_bucket{op=\"%s\",region=\"%s\",le=\"+Inf\"} %lu\n",
+		   opName, regionName, cumulative);
+	}
+	out->append(line);
+      }
+      snprintf(line, sizeof(line), "ds3_disk_latency_seconds_sum{op=\"%s\",region=\"%s\"} %.6f\n",
+	       opName, regionName, stats.micros[op][region] / 1000000.0);
+      out->append(line);
+      snprintf(line, sizeof(line), "ds3_disk_latency_seconds_count{op=\"%s\",region=\"%s\"} %lu\n",
+	       opName, regionName, stats.ops[op][region]);
+      out->append(line);
+    }
+  }
+}
+
+void MetricsService::writeStorage(string *out) {
+  if (m_dfs != NULL) {
+    FileSystemUsage usage;
+    m_dfs->usage(&usage);
+    writeHeader(out, "ds3_inodes", "gauge", "Inodes in the file system.");
+    writeValue(out, "ds3_inodes", usage.inodes);
+    writeHeader(out, "ds3_inodes_free", "gauge", "Inodes not allocated in the inode bitmap.");
+    writeValue(out, "ds3_inodes_free", usage.freeInodes);
+    writeHeader(out, "ds3_data_blocks", "gauge", "Data blocks in the file system.");
+    writeValue(out, "ds3_data_blocks", usage.dataBlocks);
+    writeHeader(out, "ds3_data_blocks_free", "gauge", "Data blocks not allocated in the data bitmap.");
+    writeValue(out, "ds3_data_blocks_free", usage.freeDataBlocks);
+    writeDisk(out, usage.disk);
+  }
+
+  if (m_files != NULL) {
+    unsigned long hits = m_files->cacheHits(), misses = m_files->cacheMisses();
+    writeHeader(out, "gunrock_file_cache_hits_total", "counter", "Static file requests served from the cache.");
+    writeValue(out, "gunrock_file_cache_hits_total", hits);
+    writeHeader(out, "gunrock_file_cache_misses_total", "counter", "Static file requests that had to go to the file system.");
+    writeValue(out, "gunrock_file_cache_misses_total", misses);
+    writeHeader(out, "gunrock_file_cache_hit_ratio", "gauge", "Hits over all lookups since the server started.");
+    writeValue(out, "gunrock_file_cache_hit_ratio", hits + misses == 0 ? 0 : (double) hits / (hits + misses));
+  }
+}
+
+void MetricsService::get(HTTPRequest *request, HTTPResponse *response) {
+  if (request->getPath().equals("/metrics/trace") && trace_enabled()) {
+    string trace;
+    trace_dump_json(&trace);
+    response->setContentType("application/json");
+    response->setBody(std::move(trace));
+    return;
+  }
+  if (!request->getPath().equals("/metrics")) {
+    throw ClientError::notFound();
+  }
+
+  string out;
+  writeRequests(&out);
+  for (size_t idx = 0; idx < m_exports.size(); idx++) {
+    Export &e = m_exports[idx];
+    writeHeader(&out, e.name.c_str(), e.counter != NULL ? "counter" : "gauge", e.help.c_str());
+    writeValue(&out, e.name.c_str(), e.counter != NULL ? (double) e.counter->load() : (double) e.gauge->load());
+  }
+  writeStorage(&out);
+
+  response->setContentType("text/plain; version=0.0.4");
+  response->setBody(std::move(out));
+}
+
+void MetricsService::head(HTTPRequest *request, HTTPResponse *response) {
+  get(request, response);
+  response->withoutBody();
+}
@@ -1,6 +1,8 @@
 #include "MyServerSocket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -8,7 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-MyServerSocket::MyServerSocket(int port)
+MyServerSocket::MyServerSocket(int port, int backlog, bool reusePort)
 {
     struct sockaddr_in server;
     int one = 1;
@@ -23,6 +25,16 @@ MyServerSocket::MyServerSocket(int port)
     if (setsockopt(serverFd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(int)) == -1) {
       throw SocketError("error with set socket opts");
     }
+
+    if (reusePort) {
+#ifdef SO_REUSEPORT
+      if (setsockopt(serverFd,SOL_SOCKET,SO_REUSEPORT,&one,sizeof(int)) == -1) {
+        throw SocketError("error setting SO_REUSEPORT");
+      }
+#else
+      throw SocketError("SO_REUSEPORT is not supported on this system");
+#endif
+    }
     
     if( bind(serverFd,(struct sockaddr *) &server, sizeof(server)) ==-1){
         char str[1024];
@@ -31,14 +43,48 @@ MyServerSocket::MyServerSocket(int port)
     }	
     
     //set up a listen queue
-    listen(serverFd, 10);
+    if (listen(serverFd, backlog) == -1) {
+      throw SocketError("could not listen");
+    }
+}
+
+MyServerSocket::MyServerSocket(const std::string &path, int backlog)
+{
+    struct sockaddr_un server;
+    struct stat st;
+
+    if (path.size() >= sizeof(server.sun_path)) {
+      throw SocketError("unix socket path is too long");
+    }
+
+    // a socket file outlives the server that made it
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      unlink(path.c_str());
+    }
+
+    serverFd = socket(AF_UNIX,SOCK_STREAM,0);
+
+    memset(&server, 0, sizeof(server));
+    server.sun_family = AF_UNIX;
+    strcpy(server.sun_path, path.c_str());
+
+    if( bind(serverFd,(struct sockaddr *) &server, sizeof(server)) ==-1){
+        char str[1024];
+        snprintf(str, 1023, "could not bind to %s", path.c_str());
+        throw SocketError(str);
+    }
+
+    if (listen(serverFd, backlog) == -1) {
+      throw SocketError("could not listen");
+    }
 }
 
 MySocket *MyServerSocket::accept()
 {
     //check that the sockFd is valid
     
-    struct sockaddr_in client;
+    // big enough for a TCP or a unix domain peer
+    struct sockaddr_storage client;
     socklen_t len = sizeof(client);
     int clientFd = ::accept(serverFd, (struct sockaddr *) &client, &len);
     
@@ -0,0 +1,127 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <time.h>
+
+// One event is 32 bytes; the ring is written by every thread through an
+// atomic index and only read when it is dumped. A dump racing with a
+// writer can catch a slot half written, which is fine for a debug view.
+// The duration is in nanoseconds and needs all 64 bits, a 32-bit one
+// wraps after about 4.3 seconds, which a slow body or response can take.
+struct TraceEvent {
+  uint64_t start;
+  uint64_t duration;
+  int64_t arg;
+  uint32_t request;
+  uint16_t phase;
+  uint16_t thread;
+};
+
+static const char *phaseNames[TRACE_PHASES] = {
+  "queue", "headers", "body", "service", "response",
+  "lookup", "create", "write", "unlink", "rename", "copy",
+  "superblock", "inode_bitmap", "data_bitmap", "inode_table",
+  "block_read", "block_write", "fsync", "commit", "rollback"
+};
+
+static const char *argNames[TRACE_PHASES] = {
+  NULL, NULL, NULL, NULL, NULL,
+  "parent", "parent", "inode", "parent", "parent", "inode",
+  NULL, "store", "store", "store",
+  "block", "block", "block", NULL, NULL
+};
+
+static std::vector<TraceEvent> ring;
+static std::atomic<uint64_t> ring_head(0);
+static std::atomic<uint32_t> next_request(0);
+static std::atomic<uint16_t> next_thread(0);
+static bool enabled = false;
+
+static thread_local uint32_t current_request = 0;
+static thread_local int current_thread = -1;
+
+void trace_enable(size_t events) {
+  ring.resize(events > 0 ? events : 1);
+  enabled = events > 0;
+}
+
+bool trace_enabled() {
+  return enabled;
+}
+
+uint64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_begin_request() {
+  if (enabled) {
+    current_request = ++next_request;
+  }
+}
+
+void trace_end_request() {
+  current_request = 0;
+}
+
+void trace_record(TracePhase phase, uint64_t start, int64_t arg) {
+  if (current_request == 0) {
+    return;
+  }
+  if (current_thread < 0) {
+    current_thread = next_thread++;
+  }
+
+  TraceEvent event;
+  event.start = start;
+  event.duration = trace_now() - start;
+  event.request = current_request;
+  event.arg = arg;
+  event.phase = phase;
+  event.thread = current_thread;
+  ring[ring_head.fetch_add(1, std::memory_order_relaxed) % ring.size()] = event;
+}
+
+TraceSpan::TraceSpan(TracePhase phase, int64_t arg) : phase(phase), arg(arg), start(0) {
+  if (current_request != 0) {
+    start = trace_now();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (start != 0) {
+    trace_record(phase, start, arg);
+  }
+}
+
+void trace_dump_json(std::string *out) {
+  out->append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  if (enabled) {
+    uint64_t head = ring_head.load(std::memory_order_relaxed);
+    uint64_t first = head > ring.size() ? head - ring.size() : 0;
+    char line[256];
+    bool any = false;
+    for (uint64_t idx = first; idx < head; idx++) {
+      const TraceEvent &event = ring[idx % ring.size()];
+      if (event.phase >= TRACE_PHASES) {
+	continue;
+      }
+      int len = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%u",
+			 any ? "," : "", phaseNames[event.phase], event.thread,
+			 event.start / 1000.0, event.duration / 1000.0, event.request);
+      out->append(line, len);
+      if (argNames[event.phase] != NULL && event.arg >= 0) {
+	len = snprintf(line, sizeof(line), ",\"%s\":%lld", argNames[event.phase], (long long) event.arg);
+	out->append(line, len);
+      }
+      out->append("}}");
+      any = true;
+    }
+  }
+  out->append("]}\n");
+}
@@ -0,0 +1,205 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "LocalFileSystem.h"
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+/*
+ The `ds3bench` utility measures LocalFileSystem operations directly, without
+ the web server in the way. Each workload formats a fresh image with `mkfs`,
+ does whatever setup it needs untimed, then times a fixed number of operations
+ one by one. For every workload it prints the throughput, latency percentiles,
+ and the block reads, writes and fsyncs the Disk did per operation.
+
+ Workloads:
+   create     create files in the root directory, one per op
+   wide       look up random names in a directory holding one entry per op
+   deep       resolve a path -p directories deep from the root
+   overwrite  rewrite the same file with -s bytes
+   readmix    read random files of -s bytes, overwriting one in ten of them
+   churn      create or unlink a random slot out of 32 files
+ */
+
+struct BenchConfig {
+    int ops; int inodes; int dataBlocks; int fileBytes; int depth; unsigned int seed;
+    string image; bool keepImage; bool deduplicate;
+};
+
+typedef void (*SetupFn)(LocalFileSystem &, const BenchConfig &, vector<int> &);
+typedef void (*OpFn)(LocalFileSystem &, const BenchConfig &, vector<int> &, int);
+
+struct Workload { const char *name; SetupFn setup; OpFn op; };
+
+// Stop the run on any file system error, numbers measured around a failure mean nothing
+static int check(int ret, const char *what) {
+    if (ret < 0) { cerr << what << " failed with " << ret << endl; exit(1); }
+    return ret;
+}
+
+static string fileName(int i) { char name[DIR_ENT_NAME_SIZE]; snprintf(name, sizeof(name), "f%d", i); return name; }
+
+static vector<char> contents(const BenchConfig &config, int i) { return vector<char>(config.fileBytes, (char)('a' + i % 26)); }
+
+static void noSetup(LocalFileSystem &, const BenchConfig &, vector<int> &) {}
+
+static void createOp(LocalFileSystem &fs, const BenchConfig &, vector<int> &, int i) {
+    check(fs.create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, fileName(i)), "create");
+}
+
+// state[0] is the wide directory
+static void wideSetup(LocalFileSystem &fs, const BenchConfig &config, vector<int> &state) {
+    int dir = check(fs.create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_DIRECTORY, "wide"), "create");
+    for (int i = 0; i < config.ops; i++) { check(fs.create(dir, UFS_REGULAR_FILE, fileName(i)), "create"); }
+    state.push_back(dir);
+}
+
+static void wideOp(LocalFileSystem &fs, const BenchConfig &config, vector<int> &state, int) {
+    check(fs.lookup(state[0], fileName(rand() % config.ops)), "lookup");
+}
+
+static void deepSetup(LocalFileSystem &fs, const BenchConfig &config, vector<int> &) {
+    int dir = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    for (int i = 0; i < config.depth; i++) { dir = check(fs.create(dir, UFS_DIRECTORY, "d" + to_string(i)), "create"); }
+}
+
+static void deepOp(LocalFileSystem &fs, const BenchConfig &config, vector<int> &, int) {
+    int dir = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    for (int i = 0; i < config.depth; i++) { dir = check(fs.lookup(dir, "d" + to_string(i)), "lookup"); }
+}
+
+// state[0] is the file being overwritten
+static void overwriteSetup(LocalFileSystem &fs, const BenchConfig &, vector<int> &state) {
+    state.push_back(check(fs.create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, "overwrite"), "create"));
+}
+
+static void overwriteOp(LocalFileSystem &fs, const BenchConfig &config, vector<int> &state, int i) {
+    vector<char> data = contents(config, i);
+    check(fs.write(state[0], data.data(), data.size()), "write");
+}
+
+// state holds the inode of each of the 32 files
+static void readmixSetup(LocalFileSystem &fs, const BenchConfig &config, vector<int> &state) {
+    for (int i = 0; i < 32; i++) {
+        int inode = check(fs.create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, fileName(i)), "create");
+        vector<char> data = contents(config, i);
+        check(fs.write(inode, data.data(), data.size()), "write"); state.push_back(inode);
+    }
+}
+
+static void readmixOp(LocalFileSystem &fs, const BenchConfig &config, vector<int> &state, int i) {
+    int inode = state[rand() % state.size()];
+    vector<char> data = contents(config, i);
+    if (rand() % 10 == 0) { check(fs.write(inode, data.data(), data.size()), "write"); }
+    else { check(fs.read(inode, data.data(), data.size()), "read"); }
+}
+
+// state[i] is 1 while slot i holds a file
+static void churnSetup(LocalFileSystem &, const BenchConfig &, vector<int> &state) { state.assign(32, 0); }
+
+static void churnOp(LocalFileSystem &fs, const BenchConfig &, vector<int> &state, int) {
+    int slot = rand() % state.size();
+    if (state[slot]) { check(fs.unlink(UFS_ROOT_DIRECTORY_INODE_NUMBER, fileName(slot)), "unlink"); }
+    else { check(fs.create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, fileName(slot)), "create"); }
+    state[slot] = !state[slot];
+}
+
+static const Workload workloads[] = {
+    { "create", noSetup, createOp },
+    { "wide", wideSetup, wideOp },
+    { "deep", deepSetup, deepOp },
+    { "overwrite", overwriteSetup, overwriteOp },
+    { "readmix", readmixSetup, readmixOp },
+    { "churn", churnSetup, churnOp },
+};
+
+static double percentile(const vector<double> &sorted, double p) {
+    return sorted[min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()))];
+}
+
+static void runWorkload(const Workload &workload, const BenchConfig &config) {
+
+    // Every workload starts from a freshly formatted image
+    string command = "./mkfs -f " + config.image + " -i " + to_string(config.inodes) + " -d " + to_string(config.dataBlocks) + " > /dev/null";
+    if (system(command.c_str()) != 0) { cerr << "could not run " << command << endl; exit(1); }
+
+    Disk disk(config.image, UFS_BLOCK_SIZE);
+    LocalFileSystem fs(&disk); fs.setDeduplicate(config.deduplicate);
+    vector<int> state; srand(config.seed);
+    workload.setup(fs, config, state);
+
+    DiskStats before, after; disk.stats(&before);
+    vector<double> latencies;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    for (int i = 0; i < config.ops; i++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        workload.op(fs, config, state, i);
+        latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    disk.stats(&after);
+
+    sort(latencies.begin(), latencies.end());
+    double reads = after.total(DISK_READ) - before.total(DISK_READ);
+    double writes = after.total(DISK_WRITE) - before.total(DISK_WRITE);
+    double fsyncs = after.total(DISK_FSYNC) - before.total(DISK_FSYNC);
+    printf("%-10s %7d %10.1f %9.1f %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f\n", workload.name, config.ops, config.ops / seconds,
+           percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), latencies.back(),
+           reads / config.ops, writes / config.ops, fsyncs / config.ops);
+}
+
+static void usage(const char *program) {
+    cerr << "usage: " << program << " [-w workload] [-n ops] [-i inodes] [-d dataBlocks] [-s fileBytes]"
+         << " [-p depth] [-r seed] [-f image] [-k (keep image)] [-D (deduplicate writes)]" << endl;
+    cerr << "workloads: all";
+    for (const Workload &workload : workloads) { cerr << " " << workload.name; }
+    cerr << endl;
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+
+    BenchConfig config = { 200, 0, 0, 4096, 16, 1, "ds3bench.img", false, false };
+    string which = "all"; int option;
+    while ((option = getopt(argc, argv, "w:n:i:d:s:p:r:f:kD")) != -1) {
+        switch (option) {
+        case 'w': which = optarg; break;
+        case 'n': config.ops = atoi(optarg); break;
+        case 'i': config.inodes = atoi(optarg); break;
+        case 'd': config.dataBlocks = atoi(optarg); break;
+        case 's': config.fileBytes = atoi(optarg); break;
+        case 'p': config.depth = atoi(optarg); break;
+        case 'r': config.seed = atoi(optarg); break;
+        case 'f': config.image = optarg; break;
+        case 'k': config.keepImage = true; break;
+        case 'D': config.deduplicate = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (config.ops < 1 || config.depth < 1 || config.fileBytes < 0 || config.fileBytes > MAX_FILE_SIZE) { usage(argv[0]); }
+
+    // Unless told otherwise, size the image so the largest workload fits
+    int blocksPerFile = (config.fileBytes + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+    if (config.inodes == 0) { config.inodes = max(64, config.ops + config.depth + 40); }
+    if (config.dataBlocks == 0) { config.dataBlocks = max(64, config.ops / 64 + config.depth + 40 * (blocksPerFile + 1)); }
+
+    printf("%-10s %7s %10s %9s %9s %9s %9s %8s %8s %8s\n", "workload", "ops", "ops/sec",
+           "p50(us)", "p90(us)", "p99(us)", "max(us)", "reads/op", "writes/op", "fsyncs/op");
+    bool found = false;
+    for (const Workload &workload : workloads) {
+        if (which == "all" || which == workload.name) { runWorkload(workload, config); found = true; }
+    }
+    if (!found) { usage(argv[0]); }
+
+    if (!config.keepImage) { unlink(config.image.c_str()); }
+    return 0;   /* Terminate Successfully */
+}
@@ -0,0 +1,264 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <signal.h>
+#include <unistd.h>
+
+#include "HttpClient.h"
+
+using namespace std;
+
+/*
+ The `ds3load` utility drives a running gunrock_web with a mix of PUT, GET,
+ DELETE and directory list requests against /ds3/, from a number of client
+ threads. Keys are picked uniformly or with a Zipfian skew, object sizes
+ uniformly from a range.
+
+ Without a target rate each thread sends its next request as soon as the
+ last one is answered (closed loop). With -r the requests are scheduled at
+ fixed intervals instead (open loop), and latency is measured both from when
+ the request was actually sent and from when it was scheduled to be sent.
+ The second number is corrected for coordinated omission: a stalled server
+ can't hide the requests that would have queued up behind the stall.
+ */
+
+typedef chrono::steady_clock Clock;
+
+// Log-linear histogram of microseconds, HDR style: each power of two is split
+// into LATENCY_SUB_BUCKETS, so any recorded value is off by at most ~1.5%
+#define LATENCY_SUB_BUCKETS (64)
+#define LATENCY_MAGNITUDES (40)
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(LATENCY_MAGNITUDES * LATENCY_SUB_BUCKETS, 0), total(0), maximum(0) {}
+
+    void record(uint64_t micros) {
+        counts[index(micros)]++; total++; maximum = max(maximum, micros);
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < counts.size(); i++) { counts[i] += other.counts[i]; }
+        total += other.total; maximum = max(maximum, other.maximum);
+    }
+
+    // The upper end of the bucket holding the pth percentile
+    uint64_t percentile(double p) const {
+        if (total == 0) { return 0; }
+        uint64_t rank = (uint64_t)ceil(p / 100.0 * total), seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= max(rank, (uint64_t)1)) { return min(upperBound(i), maximum); }
+        }
+        return maximum;
+    }
+
+    uint64_t count() const { return total; }
+
+private:
+    static size_t index(uint64_t value) {
+        if (value < LATENCY_SUB_BUCKETS) { return value; }
+        int magnitude = 63 - __builtin_clzll(value) - 5;   // value >> magnitude lands in [32, 64)
+        size_t i = magnitude * (LATENCY_SUB_BUCKETS / 2) + (value >> magnitude);
+        return min(i, (size_t)LATENCY_MAGNITUDES * LATENCY_SUB_BUCKETS - 1);
+    }
+    static uint64_t upperBound(size_t i) {
+        if (i < LATENCY_SUB_BUCKETS) { return i; }
+        size_t magnitude = (i - LATENCY_SUB_BUCKETS / 2) / (LATENCY_SUB_BUCKETS / 2);
+        uint64_t sub = i - magnitude * (LATENCY_SUB_BUCKETS / 2);
+        return ((sub + 1) << magnitude) - 1;
+    }
+
+    vector<uint64_t> counts; uint64_t total; uint64_t maximum;
+};
+
+enum Operation { OP_PUT, OP_GET, OP_DELETE, OP_LIST, OPERATIONS };
+static const char *operationNames[OPERATIONS] = { "put", "get", "delete", "list" };
+
+struct LoadConfig {
+    string host; int port; int threads; int requests; double seconds; double rate;
+    int weights[OPERATIONS]; int keys; double zipf; int minSize; int maxSize;
+    string prefix; bool populate;
+};
+
+struct ThreadResult {
+    LatencyHistogram service;     // from send to the end of the response
+    LatencyHistogram intended;    // from the scheduled send time, corrected for coordinated omission
+    map<int, uint64_t> statuses;  // 0 for requests that failed outright
+    uint64_t operations[OPERATIONS];
+    uint64_t bytes;
+};
+
+// Picks key k with probability proportional to 1 / (k + 1)^zipf
+class KeyChooser {
+public:
+    KeyChooser(int keys, double zipf) {
+        double sum = 0;
+        for (int k = 0; k < keys; k++) { sum += 1.0 / pow(k + 1, zipf); cdf.push_back(sum); }
+        for (double &c : cdf) { c /= sum; }
+    }
+    int pick(mt19937_64 &rng) {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        return min((size_t)(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), cdf.size() - 1);
+    }
+private:
+    vector<double> cdf;
+};
+
+static string keyPath(const LoadConfig &config, int key) { return config.prefix + "k" + to_string(key); }
+
+// HttpClient takes a kept-alive connection from its pool when there is one,
+// so a client per request doesn't mean a connect per request
+static int sendRequest(const LoadConfig &config, Operation op, const string &path, const string &body, uint64_t *bytes) {
+    try {
+        HttpClient client(config.host.c_str(), config.port);
+        HTTPClientResponse *response = NULL;
+        switch (op) {
+        case OP_PUT: response = client.put(path, body); break;
+        case OP_GET: response = client.get(path); break;
+        case OP_DELETE: response = client.del(path); break;
+        default: response = client.get(config.prefix); break;
+        }
+        int status = response->status(); *bytes += body.size() + response->body().size();
+        delete response; return status;
+    } catch (...) {
+        return 0;
+    }
+}
+
+static void runThread(const LoadConfig &config, int id, int requests, KeyChooser *chooser, ThreadResult *result) {
+    mt19937_64 rng(id + 1);
+    uniform_int_distribution<int> sizes(config.minSize, config.maxSize);
+    int totalWeight = 0; for (int w : config.weights) { totalWeight += w; }
+    result->bytes = 0; fill(result->operations, result->operations + OPERATIONS, 0);
+
+    // Open loop: this thread's share of the rate, staggered so threads don't fire together
+    Clock::duration interval = config.rate > 0 ? chrono::duration_cast<Clock::duration>(chrono::duration<double>(config.threads / config.rate)) : Clock::duration(0);
+    Clock::time_point begin = Clock::now(), scheduled = begin + interval * id / config.threads;
+    Clock::time_point deadline = begin + chrono::duration_cast<Clock::duration>(chrono::duration<double>(config.seconds));
+
+    for (int i = 0; requests == 0 || i < requests; i++) {
+        if (config.rate > 0) { this_thread::sleep_until(scheduled); }
+        Clock::time_point start = Clock::now();
+        if (config.seconds > 0 && start >= deadline) { break; }
+        if (config.rate == 0) { scheduled = start; }
+
+        int roll = uniform_int_distribution<int>(0, totalWeight - 1)(rng), op = 0;
+        while (roll >= config.weights[op]) { roll -= config.weights[op]; op++; }
+        string path = keyPath(config, chooser->pick(rng));
+        string body = op == OP_PUT ? string(sizes(rng), (char)('a' + i % 26)) : "";
+
+        int status = sendRequest(config, (Operation)op, path, body, &result->bytes);
+        Clock::time_point end = Clock::now();
+        result->service.record(chrono::duration_cast<chrono::microseconds>(end - start).count());
+        result->intended.record(chrono::duration_cast<chrono::microseconds>(end - scheduled).count());
+        result->statuses[status]++; result->operations[op]++;
+        scheduled += interval;
+    }
+}
+
+static bool parseMix(const string &mix, int *weights) {
+    fill(weights, weights + OPERATIONS, 0);
+    size_t start = 0;
+    while (start < mix.size()) {
+        size_t comma = mix.find(',', start); if (comma == string::npos) { comma = mix.size(); }
+        string item = mix.substr(start, comma - start); size_t equals = item.find('=');
+        if (equals == string::npos) { return false; }
+        int op = 0; while (op < OPERATIONS && item.substr(0, equals) != operationNames[op]) { op++; }
+        if (op == OPERATIONS) { return false; }
+        weights[op] = atoi(item.c_str() + equals + 1); start = comma + 1;
+    }
+    int total = 0; for (int op = 0; op < OPERATIONS; op++) { if (weights[op] < 0) { return false; } total += weights[op]; }
+    return total > 0;
+}
+
+static void printHistogram(const char *name, const LatencyHistogram &histogram) {
+    printf("%-22s %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, histogram.percentile(50) / 1000.0, histogram.percentile(90) / 1000.0,
+           histogram.percentile(99) / 1000.0, histogram.percentile(99.9) / 1000.0, histogram.percentile(99.99) / 1000.0, histogram.percentile(100) / 1000.0);
+}
+
+static void usage(const char *program) {
+    cerr << "usage: " << program << " [-h host|unix:socketPath] [-p port] [-c threads] [-n requests | -d seconds] [-r requestsPerSecond]"
+         << " [-m put=N,get=N,delete=N,list=N] [-k keys] [-z zipfExponent] [-s minBytes[:maxBytes]]"
+         << " [-P pathPrefix] [-N (don't populate keys first)]" << endl;
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+
+    // a server closing a pooled connection mustn't kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    LoadConfig config = { "localhost", 8080, 4, 1000, 0, 0, { 20, 70, 5, 5 }, 32, 0, 1024, 1024, "/ds3/load/", true };
+    int option;
+    while ((option = getopt(argc, argv, "h:p:c:n:d:r:m:k:z:s:P:N")) != -1) {
+        switch (option) {
+        case 'h': config.host = optarg; break;
+        case 'p': config.port = atoi(optarg); break;
+        case 'c': config.threads = atoi(optarg); break;
+        case 'n': config.requests = atoi(optarg); break;
+        case 'd': config.seconds = atof(optarg); config.requests = 0; break;
+        case 'r': config.rate = atof(optarg); break;
+        case 'm': if (!parseMix(optarg, config.weights)) { usage(argv[0]); } break;
+        case 'k': config.keys = atoi(optarg); break;
+        case 'z': config.zipf = atof(optarg); break;
+        case 's': config.minSize = config.maxSize = atoi(optarg);
+                  if (strchr(optarg, ':') != NULL) { config.maxSize = atoi(strchr(optarg, ':') + 1); } break;
+        case 'P': config.prefix = optarg; break;
+        case 'N': config.populate = false; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (config.threads < 1 || config.keys < 1 || config.requests < 0 || config.rate < 0 || config.zipf < 0
+        || config.minSize < 1 || config.maxSize < config.minSize || (config.requests == 0 && config.seconds <= 0)) { usage(argv[0]); }
+    if (config.prefix.empty() || config.prefix.back() != '/') { config.prefix += "/"; }
+
+    // Give GETs something to find
+    if (config.populate) {
+        uint64_t bytes = 0;
+        for (int key = 0; key < config.keys; key++) {
+            int status = sendRequest(config, OP_PUT, keyPath(config, key), string(config.minSize, 'p'), &bytes);
+            if (status != 200) { cerr << "populating " << keyPath(config, key) << " failed with status " << status << endl; return 1; }
+        }
+    }
+
+    KeyChooser chooser(config.keys, config.zipf);
+    vector<ThreadResult> results(config.threads);
+    vector<thread> threads;
+    Clock::time_point begin = Clock::now();
+    for (int id = 0; id < config.threads; id++) {
+        int requests = config.requests == 0 ? 0 : config.requests / config.threads + (id < config.requests % config.threads ? 1 : 0);
+        if (config.requests != 0 && requests == 0) { continue; }
+        threads.push_back(thread(runThread, cref(config), id, requests, &chooser, &results[id]));
+    }
+    for (thread &t : threads) { t.join(); }
+    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+
+    ThreadResult total; total.bytes = 0; fill(total.operations, total.operations + OPERATIONS, 0);
+    for (ThreadResult &result : results) {
+        total.service.merge(result.service); total.intended.merge(result.intended); total.bytes += result.bytes;
+        for (auto &status : result.statuses) { total.statuses[status.first] += status.second; }
+        for (int op = 0; op < OPERATIONS; op++) { total.operations[op] += result.operations[op]; }
+    }
+
+    printf("%s loop, %d threads, %.2f s\n", config.rate > 0 ? "open" : "closed", config.threads, seconds);
+    printf("requests   %llu (%.1f/s), %.2f MB/s\n", (unsigned long long)total.service.count(), total.service.count() / seconds, total.bytes / seconds / 1e6);
+    printf("operations");
+    for (int op = 0; op < OPERATIONS; op++) { printf(" %s=%llu", operationNames[op], (unsigned long long)total.operations[op]); }
+    printf("\nstatuses  ");
+    for (auto &status : total.statuses) { printf(" %s=%llu", status.first == 0 ? "error" : to_string(status.first).c_str(), (unsigned long long)status.second); }
+    printf("\n%-22s %9s %9s %9s %9s %9s %9s\n", "latency (ms)", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    printHistogram("service", total.service);
+    if (config.rate > 0) { printHistogram("corrected (intended)", total.intended); }
+    return 0;   /* Terminate Successfully */
+}
@@ -3,58 +3,179 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <atomic>
+#include <algorithm>
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 
-pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
-std::vector<pthread_t> thread_list;
+// Logging goes through a ring per thread that only that thread writes
+// and only the writer thread reads, so sync_print never takes a lock or
+// makes a system call. A full ring drops the entry rather than making
+// the request wait for the disk.
+#define LOG_RING_ENTRIES (1024)
+#define LOG_ENTRY_BYTES (248)
+#define LOG_DRAIN_INTERVAL_US (5000)
+
+struct LogEntry {
+  unsigned long long seq;
+  char text[LOG_ENTRY_BYTES];
+};
+
+struct LogRing {
+  LogEntry entries[LOG_RING_ENTRIES];
+  std::atomic<size_t> head; // next slot the owning thread fills
+  std::atomic<size_t> tail; // next slot the writer thread drains
+  std::atomic<bool> closed; // the owning thread has exited
+};
+
+// frees up the thread's ring for the writer to collect once it exits
+struct LogRingOwner {
+  LogRing *ring;
+  LogRingOwner() : ring(NULL) {}
+  ~LogRingOwner() {
+    if (ring != NULL) {
+      ring->closed.store(true, std::memory_order_release);
+    }
+  }
+};
+
+pthread_mutex_t ring_list_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+std::vector<LogRing *> ring_list;
+std::atomic<unsigned long long> log_seq(0);
+std::atomic<unsigned long long> log_dropped(0);
+std::atomic<int> next_tid(0);
+thread_local LogRingOwner ring_owner;
+thread_local int thread_tid = -1;
 int logFd = -1;
 
+// moves everything the rings hold to the log file in one write, in the
+// order the entries were logged
+static void drain_logs() {
+  pthread_mutex_lock(&drain_lock);
+
+  std::vector<LogEntry *> batch;
+  pthread_mutex_lock(&ring_list_lock);
+  std::vector<LogRing *> rings = ring_list;
+  pthread_mutex_unlock(&ring_list_lock);
+
+  std::vector<size_t> ends(rings.size());
+  for (size_t idx = 0; idx < rings.size(); idx++) {
+    LogRing *ring = rings[idx];
+    ends[idx] = ring->head.load(std::memory_order_acquire);
+    for (size_t pos = ring->tail.load(std::memory_order_relaxed); pos != ends[idx]; pos++) {
+      batch.push_back(&ring->entries[pos % LOG_RING_ENTRIES]);
+    }
+  }
+  std::sort(batch.begin(), batch.end(),
+	    [](const LogEntry *a, const LogEntry *b) { return a->seq < b->seq; });
+
+  std::string out;
+  for (size_t idx = 0; idx < batch.size(); idx++) {
+    out.append(batch[idx]->text);
+  }
+  unsigned long long dropped = log_dropped.exchange(0);
+  if (dropped > 0) {
+    out.append("log_dropped entries: " + std::to_string(dropped) + "\n");
+  }
+
+  // the slots can only be reused once their text has been copied out
+  for (size_t idx = 0; idx < rings.size(); idx++) {
+    rings[idx]->tail.store(ends[idx], std::memory_order_release);
+  }
+
+  size_t written = 0;
+  while (written < out.size()) {
+    ssize_t ret = write(logFd, out.data() + written, out.size() - written);
+    if (ret < 0) {
+      std::cerr << "log file write error" << std::endl;
+      exit(1);
+    }
+    written += ret;
+  }
+
+  // rings of threads that have exited and been drained are done
+  pthread_mutex_lock(&ring_list_lock);
+  for (size_t idx = 0; idx < ring_list.size();) {
+    LogRing *ring = ring_list[idx];
+    if (ring->closed.load(std::memory_order_acquire) &&
+	ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire)) {
+      ring_list.erase(ring_list.begin() + idx);
+      delete ring;
+    } else {
+      idx++;
+    }
+  }
+  pthread_mutex_unlock(&ring_list_lock);
+
+  pthread_mutex_unlock(&drain_lock);
+}
+
+static void *log_writer(void *arg) {
+  while (true) {
+    usleep(LOG_DRAIN_INTERVAL_US);
+    drain_logs();
+  }
+  return NULL;
+}
+
 void set_log_file(std::string file_name) {
   logFd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
   if (logFd < 0) {
     std::cerr << "Could not open log file: " << file_name << std::endl;
     exit(1);
   }
-}
 
-void sync_print(std::string function, std::string payload) {
-  int ret = pthread_mutex_lock(&print_lock);
-  if (ret != 0) {
-    std::cerr << "pthread lock mutex error!" << std::endl;
-    exit(1);
+  // nothing to do for the default log, don't pay for formatting it
+  if (file_name == "/dev/null") {
+    close(logFd);
+    logFd = -1;
+    return;
   }
 
-  // search through our thread list to find this thread
-  pthread_t self = pthread_self();
-  int tid = -1;
-  for (size_t idx = 0; idx < thread_list.size(); idx++) {
-    if (pthread_equal(self, thread_list[idx])) {
-      tid = idx;
-      break;
-    }
+  pthread_t writer;
+  pthread_create(&writer, NULL, log_writer, NULL);
+  pthread_detach(writer);
+  atexit(drain_logs);
+}
+
+void sync_print(const std::string &function, const std::string &payload) {
+  if (logFd < 0) {
+    return;
   }
 
-  // if we don't find self in our thread list, add it
-  if (tid < 0) {
-    tid = thread_list.size();
-    thread_list.push_back(self);
+  // first time through on this thread, number it and give it a ring
+  if (ring_owner.ring == NULL) {
+    thread_tid = next_tid++;
+    LogRing *ring = new LogRing();
+    ring->head = 0;
+    ring->tail = 0;
+    ring->closed = false;
+    pthread_mutex_lock(&ring_list_lock);
+    ring_list.push_back(ring);
+    pthread_mutex_unlock(&ring_list_lock);
+    ring_owner.ring = ring;
   }
 
-  std::stringstream write_stream;
-  write_stream << function << " thread: " << tid << " " << payload << std::endl;
-  std::string write_buffer = write_stream.str();
-  ret = write(logFd, write_buffer.c_str(), write_buffer.length());
-  if (ret >= 0 && (size_t) ret != write_buffer.length()) {
-    std::cerr << "log file write error, ret = " << ret << " expected " << write_buffer.length() << std::endl;
-    exit(1);
+  LogRing *ring = ring_owner.ring;
+  size_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_ENTRIES) {
+    log_dropped++;
+    return;
   }
-  ret = pthread_mutex_unlock(&print_lock);
-  if (ret != 0) {
-    std::cerr << "pthread mutex unlock error!" << std::endl;
-    exit(1);
+
+  LogEntry *entry = &ring->entries[head % LOG_RING_ENTRIES];
+  entry->seq = log_seq++;
+  int length = snprintf(entry->text, LOG_ENTRY_BYTES, "%s thread: %d %s\n",
+			function.c_str(), thread_tid, payload.c_str());
+  // keep the line ending on entries that didn't fit
+  if (length >= LOG_ENTRY_BYTES) {
+    entry->text[LOG_ENTRY_BYTES - 2] = '\n';
   }
+  ring->head.store(head + 1, std::memory_order_release);
 }
 
 void sync_print_thread(std::string function, pthread_mutex_t *mutex, pthread_cond_t *cond) {
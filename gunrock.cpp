@@ -1,8 +1,10 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <iostream>
 #include <memory>
@@ -10,6 +12,8 @@
 #include <vector>
 #include <sstream>
 #include <deque>
+#include <map>
+#include <atomic>
 
 #include "ClientError.h"
 #include "HTTPRequest.h"
@@ -18,9 +22,11 @@
 #include "HttpUtils.h"
 #include "FileService.h"
 #include "DistributedFileSystemService.h"
+#include "MetricsService.h"
 #include "MySocket.h"
 #include "MyServerSocket.h"
 #include "dthread.h"
+#include "Trace.h"
 
 using namespace std;
 int PORT = 8080;
@@ -30,13 +36,73 @@ string BASEDIR = "ds3";
 string SCHEDALG = "FIFO";
 string LOGFILE = "/dev/null";
 string DISKFILE = "disk.img";
+// share identical file blocks instead of writing them again, see LocalFileSystem::setDeduplicate
+bool DEDUPLICATE = false;
+int ACCEPTORS = 1;
+int BACKLOG = 128;
+bool REUSEPORT = false;
+// unix domain socket to listen on as well as, or with -p 0 instead of, TCP
+string UNIX_SOCKET = "";
+// per connection deadlines in milliseconds, 0 turns one off
+int HEADER_TIMEOUT_MS = 10000;
+int BODY_TIMEOUT_MS = 60000;
+int WRITE_TIMEOUT_MS = 60000;
+// request size caps in bytes, 0 turns one off
+int MAX_HEADER_BYTES = 16 * 1024;
+long long MAX_BODY_BYTES = 16 * 1024 * 1024;
+
+// how far behind the server may be before a method's requests are shed
+// with a 503, -1 meaning no limit. queueDepth counts connections waiting
+// for a worker, writeBacklog counts writes in progress. "*" covers
+// methods without an entry of their own. The method isn't known when a
+// connection is accepted, so only a "*" entry sheds connections the
+// queue has no room for; otherwise the acceptors wait for room and the
+// limits are checked once each request is parsed.
+struct ShedLimit {
+  int queueDepth;
+  int writeBacklog;
+};
+map<string, ShedLimit> SHED_LIMITS;
+int RETRY_AFTER_SECONDS = 1;
+// how long, and for how many bytes, a shed connection is drained after
+// its 503 before it is closed
+int SHED_LINGER_MS = 100;
+int SHED_LINGER_BYTES = 64 * 1024;
+
+// connections closed because a deadline passed, and requests refused for size
+atomic<unsigned long> timed_out_connections(0);
+atomic<unsigned long> oversized_requests(0);
+// requests turned away with a 503, at accept time or once parsed
+atomic<unsigned long> shed_requests(0);
+// mirrors connections.size() so it can be read without the lock
+atomic<int> queued_connections(0);
+// PUT, POST, DELETE, MOVE and COPY requests being served right now
+atomic<int> pending_writes(0);
+// connections a worker has taken off the queue and not yet closed
+atomic<int> active_connections(0);
 
 vector<HttpService *> services;
+MetricsService *metrics;
+
+// events the trace ring holds, 0 leaves tracing off
+int TRACE_EVENTS = 0;
+
+// an accepted connection waiting for a worker thread
+struct QueuedConnection {
+  MySocket *client;
+  uint64_t accepted; // trace_now() at accept, if tracing
+};
+
+// at most BUFFER_SIZE of them
+deque<QueuedConnection> connections;
+pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t connection_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t connection_taken = PTHREAD_COND_INITIALIZER;
 
 HttpService *find_service(HTTPRequest *request) {
    // find a service that is registered for this path prefix
   for (unsigned int idx = 0; idx < services.size(); idx++) {
-    if (request->getPath().find(services[idx]->pathPrefix()) == 0) {
+    if (request->getPath().startsWith(services[idx]->pathPrefix())) {
       return services[idx];
     }
   }
@@ -65,6 +131,8 @@ void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPRespo
       service->del(request, response);
     } else if (request->isMove()) {
       service->move(request, response);
+    } else if (request->isCopy()) {
+      service->copy(request, response);
     } else {
       // The server doesn't know about this method
       response->setStatus(501);
@@ -78,18 +146,110 @@ void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPRespo
   }
 }
 
-void handle_request(MySocket *client) {
+// records why a request was cut short, so the counters and log agree
+void count_refusal(int status, const string &payload) {
+  if (status == 408) {
+    timed_out_connections++;
+    sync_print("request_timeout", payload);
+  } else if (status == 413 || status == 431) {
+    oversized_requests++;
+    sync_print("request_too_large", payload);
+  }
+}
+
+// parses a -L argument, METHOD=queueDepth[,writeBacklog]
+bool parse_shed_limit(const string &arg) {
+  size_t equals = arg.find('=');
+  if (equals == string::npos || equals == 0) {
+    return false;
+  }
+  ShedLimit limit;
+  limit.writeBacklog = -1;
+  if (sscanf(arg.c_str() + equals + 1, "%d,%d", &limit.queueDepth, &limit.writeBacklog) < 1) {
+    return false;
+  }
+  SHED_LIMITS[arg.substr(0, equals)] = limit;
+  return true;
+}
+
+bool should_shed(HTTPRequest *request) {
+  map<string, ShedLimit>::iterator limit = SHED_LIMITS.find(request->getMethodName());
+  if (limit == SHED_LIMITS.end()) {
+    limit = SHED_LIMITS.find("*");
+  }
+  if (limit == SHED_LIMITS.end()) {
+    return false;
+  }
+  if (limit->second.queueDepth >= 0 && queued_connections >= limit->second.queueDepth) {
+    return true;
+  }
+  return limit->second.writeBacklog >= 0 && pending_writes >= limit->second.writeBacklog;
+}
+
+void set_unavailable(HTTPResponse *response) {
+  shed_requests++;
+  response->setStatus(503);
+  response->setHeader("Retry-After", to_string(RETRY_AFTER_SECONDS));
+}
+
+// closing a socket with unread request bytes makes the kernel reset the
+// connection, which can throw away a 503 the client hasn't read yet. So
+// stop writing, drain what the client sends for a moment, then close
+void close_lingering(MySocket *client) {
+  try {
+    client->shutdownWrite();
+    client->setReadDeadline(SHED_LINGER_MS);
+    char buffer[4096];
+    for (int drained = 0; drained < SHED_LINGER_BYTES; ) {
+      drained += client->read(buffer, sizeof(buffer));
+    }
+  } catch (...) {
+    // end of file, or the client is taking too long
+  }
+  client->close();
+}
+
+double seconds_since(const struct timespec &start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void handle_request(MySocket *client, uint64_t accepted) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  active_connections++;
+  trace_begin_request();
+  if (accepted != 0) {
+    trace_record(TRACE_QUEUE, accepted);
+  }
   HTTPRequest *request = new HTTPRequest(client, PORT);
   HTTPResponse *response = new HTTPResponse();
   stringstream payload;
+
+  request->setLimits(MAX_HEADER_BYTES, MAX_BODY_BYTES > 0 ? MAX_BODY_BYTES : -1);
   
   // read in the request
   bool readResult = false;
   try {
     payload << "client: " << (void *) client;
     sync_print("read_request_enter", payload.str());
-    readResult = request->readRequest();
+    client->setReadDeadline(HEADER_TIMEOUT_MS);
+    TraceSpan span(TRACE_HEADERS);
+    readResult = request->readHeaders();
     sync_print("read_request_return", payload.str());
+  } catch (SocketTimeout &) {
+    // a client trickling its headers in gets nothing but a closed socket
+    count_refusal(408, payload.str());
+  } catch (ClientError &ce) {
+    // too large to parse, say so and drop the rest
+    count_refusal(ce.status_code, payload.str());
+    response->setStatus(ce.status_code);
+    try {
+      client->setWriteDeadline(WRITE_TIMEOUT_MS);
+      response->send(client);
+    } catch (...) {
+    }
   } catch (...) {
     // swallow it
   }    
@@ -99,18 +259,61 @@ void handle_request(MySocket *client) {
     delete response;
     delete request;
     sync_print("read_request_error", payload.str());
+    client->close();
+    delete client;
+    active_connections--;
+    trace_end_request();
     return;
   }
   
-  HttpService *service = find_service(request);
-  invoke_service_method(service, request, response);
+  // one deadline covers the whole body, however the service reads it
+  client->setReadDeadline(BODY_TIMEOUT_MS);
+  bool shed = should_shed(request);
+  if (shed) {
+    set_unavailable(response);
+    sync_print("request_shed", payload.str());
+  } else {
+    bool isWrite = request->isPut() || request->isPost() || request->isDelete() || request->isMove() || request->isCopy();
+    if (isWrite) {
+      pending_writes++;
+    }
+    HttpService *service = find_service(request);
+    uint64_t serviceStart = trace_now();
+    invoke_service_method(service, request, response);
+    trace_record(TRACE_SERVICE, serviceStart);
+    if (isWrite) {
+      pending_writes--;
+    }
+    count_refusal(response->getStatus(), payload.str());
+  }
+
+  // services pull in the body themselves, drain anything they left. A
+  // shed request's body isn't worth reading, the connection lingers instead
+  bool drained = !shed && response->getStatus() != 408 && response->getStatus() != 413;
+  try {
+    if (drained && !request->isDone()) {
+      request->discardBody();
+    }
+  } catch (...) {
+    // the client went away, we'll notice when we write
+  }
 
   // send data back to the client and clean up
   payload.str(""); payload.clear();
   payload << " RESPONSE " << response->getStatus() << " client: " << (void *) client;
   sync_print("write_response", payload.str());
-  cout << payload.str() << endl;
-  client->write(response->response());
+  try {
+    client->setWriteDeadline(WRITE_TIMEOUT_MS);
+    TraceSpan span(TRACE_RESPONSE);
+    response->send(client);
+  } catch (SocketTimeout &) {
+    count_refusal(408, payload.str());
+  } catch (...) {
+    // the client went away or the body couldn't be produced mid-stream,
+    // either way all that's left is to close the connection
+    sync_print("write_response_error", payload.str());
+  }
+  metrics->recordRequest(request->getMethodName(), response->getStatus(), seconds_since(start));
     
   delete response;
   delete request;
@@ -118,8 +321,83 @@ void handle_request(MySocket *client) {
   payload.str(""); payload.clear();
   payload << " client: " << (void *) client;
   sync_print("close_connection", payload.str());
-  client->close();
+  if (shed) {
+    close_lingering(client);
+  } else {
+    client->close();
+  }
   delete client;
+  active_connections--;
+  trace_end_request();
+}
+
+void *worker(void *arg) {
+  while (true) {
+    dthread_mutex_lock(&connections_lock);
+    while (connections.empty()) {
+      dthread_cond_wait(&connection_ready, &connections_lock);
+    }
+    QueuedConnection connection = connections.front();
+    connections.pop_front();
+    queued_connections--;
+    dthread_cond_signal(&connection_taken);
+    dthread_mutex_unlock(&connections_lock);
+
+    handle_request(connection.client, connection.accepted);
+  }
+  return NULL;
+}
+
+// answers 503 without reading the request, the response is small enough
+// that the write lands in the socket buffer rather than waiting on the client
+void shed_connection(MySocket *client) {
+  HTTPResponse response;
+  set_unavailable(&response);
+  sync_print("connection_shed", "");
+  try {
+    client->setWriteDeadline(WRITE_TIMEOUT_MS);
+    response.send(client);
+  } catch (...) {
+  }
+  close_lingering(client);
+  delete client;
+}
+
+void *acceptor(void *arg) {
+  MyServerSocket *server = (MyServerSocket *) arg;
+  while (true) {
+    sync_print("waiting_to_accept", "");
+    MySocket *client;
+    try {
+      client = server->accept();
+    } catch (SocketError &e) {
+      // e.g. out of descriptors, the next accept may well work
+      sync_print("accept_error", e.what());
+      continue;
+    }
+    sync_print("client_accepted", "");
+
+    // once the queue reaches the catch-all limit (or every buffer is in
+    // use) turn the client away straight off, otherwise wait for a slot
+    // and let the backlog fill
+    map<string, ShedLimit>::iterator limit = SHED_LIMITS.find("*");
+    int shedDepth = limit == SHED_LIMITS.end() ? -1 : min(BUFFER_SIZE, limit->second.queueDepth);
+    dthread_mutex_lock(&connections_lock);
+    if (shedDepth >= 0 && (int) connections.size() >= shedDepth) {
+      dthread_mutex_unlock(&connections_lock);
+      shed_connection(client);
+      continue;
+    }
+    while ((int) connections.size() >= BUFFER_SIZE) {
+      dthread_cond_wait(&connection_taken, &connections_lock);
+    }
+    QueuedConnection connection = { client, trace_enabled() ? trace_now() : 0 };
+    connections.push_back(connection);
+    queued_connections++;
+    dthread_cond_signal(&connection_ready);
+    dthread_mutex_unlock(&connections_lock);
+  }
+  return NULL;
 }
 
 int main(int argc, char *argv[]) {
@@ -127,7 +405,7 @@ int main(int argc, char *argv[]) {
   signal(SIGPIPE, SIG_IGN);
   int option;
 
-  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:")) != -1) {
+  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:Da:q:ru:H:R:W:m:M:L:Y:T:")) != -1) {
     switch (option) {
     case 'd':
       BASEDIR = string(optarg);
@@ -150,29 +428,128 @@ int main(int argc, char *argv[]) {
     case 'i':
       DISKFILE = string(optarg);
       break;
+    case 'D':
+      DEDUPLICATE = true;
+      break;
+    case 'a':
+      ACCEPTORS = atoi(optarg);
+      break;
+    case 'q':
+      BACKLOG = atoi(optarg);
+      break;
+    case 'r':
+      REUSEPORT = true;
+      break;
+    case 'u':
+      UNIX_SOCKET = string(optarg);
+      break;
+    case 'H':
+      HEADER_TIMEOUT_MS = atoi(optarg);
+      break;
+    case 'R':
+      BODY_TIMEOUT_MS = atoi(optarg);
+      break;
+    case 'W':
+      WRITE_TIMEOUT_MS = atoi(optarg);
+      break;
+    case 'm':
+      MAX_HEADER_BYTES = atoi(optarg);
+      break;
+    case 'M':
+      MAX_BODY_BYTES = atoll(optarg);
+      break;
+    case 'L':
+      if (!parse_shed_limit(optarg)) {
+        cerr << "bad shed limit " << optarg << ", expected METHOD=queueDepth[,writeBacklog]" << endl;
+        exit(1);
+      }
+      break;
+    case 'Y':
+      RETRY_AFTER_SECONDS = atoi(optarg);
+      break;
+    case 'T':
+      TRACE_EVENTS = atoi(optarg);
+      break;
     default:
-      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i diskFile]" << endl;
+      cerr<< "usage: " << argv[0] << " [-p port (0 for none)] [-t threads] [-b buffers] [-i diskFile] [-D (deduplicate)]"
+	  << " [-a acceptors] [-q listenBacklog] [-r (SO_REUSEPORT)] [-u unixSocketPath]"
+	  << " [-H headerTimeoutMs] [-R bodyTimeoutMs] [-W writeTimeoutMs]"
+	  << " [-m maxHeaderBytes] [-M maxBodyBytes]"
+	  << " [-L METHOD=queueDepth[,writeBacklog]]... [-Y retryAfterSeconds]"
+	  << " [-T traceEvents]" << endl;
       exit(1);
     }
   }
 
+  if (THREAD_POOL_SIZE < 1 || BUFFER_SIZE < 1 || ACCEPTORS < 1 || BACKLOG < 1) {
+    cerr << "threads, buffers, acceptors and backlog must all be at least 1" << endl;
+    exit(1);
+  }
+  if (PORT == 0 && UNIX_SOCKET.empty()) {
+    cerr << "with no TCP port there has to be a unix socket to listen on" << endl;
+    exit(1);
+  }
+  if (HEADER_TIMEOUT_MS < 0 || BODY_TIMEOUT_MS < 0 || WRITE_TIMEOUT_MS < 0
+      || MAX_HEADER_BYTES < 0 || MAX_BODY_BYTES < 0 || TRACE_EVENTS < 0) {
+    cerr << "timeouts, size limits and trace events can't be negative" << endl;
+    exit(1);
+  }
+
   set_log_file(LOGFILE);
+  trace_enable(TRACE_EVENTS);
 
-  cout << "Lisening on port " << PORT << endl;
+  if (PORT != 0) {
+    cout << "Lisening on port " << PORT << endl;
+  }
+  if (!UNIX_SOCKET.empty()) {
+    cout << "Lisening on " << UNIX_SOCKET << endl;
+  }
   
   sync_print("init", "");
-  MyServerSocket *server = new MyServerSocket(PORT);
-  MySocket *client;
+
+  // with SO_REUSEPORT every acceptor gets its own socket and the kernel
+  // balances connections across them, otherwise they share one
+  vector<MyServerSocket *> servers;
+  for (int idx = 0; PORT != 0 && idx < (REUSEPORT ? ACCEPTORS : 1); idx++) {
+    servers.push_back(new MyServerSocket(PORT, BACKLOG, REUSEPORT));
+  }
 
   // The order that you push services dictates the search order
   // for path prefix matching
-  services.push_back(new DistributedFileSystemService(DISKFILE));
-  services.push_back(new FileService(BASEDIR));
-  
-  while(true) {
-    sync_print("waiting_to_accept", "");
-    client = server->accept();
-    sync_print("client_accepted", "");
-    handle_request(client);
+  DistributedFileSystemService *dfs = new DistributedFileSystemService(DISKFILE, DEDUPLICATE);
+  FileService *files = new FileService(BASEDIR);
+  metrics = new MetricsService(dfs, files);
+  metrics->addGauge("gunrock_queued_connections", "Accepted connections waiting for a worker.", &queued_connections);
+  metrics->addGauge("gunrock_active_connections", "Connections a worker is serving.", &active_connections);
+  metrics->addGauge("gunrock_pending_writes", "Write requests being served.", &pending_writes);
+  metrics->addCounter("gunrock_timed_out_connections_total", "Connections cut off by a read or write deadline.", &timed_out_connections);
+  metrics->addCounter("gunrock_oversized_requests_total", "Requests refused for oversized headers or bodies.", &oversized_requests);
+  metrics->addCounter("gunrock_shed_requests_total", "Requests turned away with a 503 under load.", &shed_requests);
+  services.push_back(dfs);
+  services.push_back(metrics);
+  services.push_back(files);
+
+  for (int idx = 0; idx < THREAD_POOL_SIZE; idx++) {
+    pthread_t thread;
+    dthread_create(&thread, NULL, worker, NULL);
+    dthread_detach(thread);
+  }
+  // alongside TCP the unix socket gets one acceptor of its own, without
+  // TCP it is the only socket and every acceptor shares it
+  if (!UNIX_SOCKET.empty()) {
+    MyServerSocket *local = new MyServerSocket(UNIX_SOCKET, BACKLOG);
+    if (servers.empty()) {
+      servers.push_back(local);
+    } else {
+      pthread_t thread;
+      dthread_create(&thread, NULL, acceptor, local);
+      dthread_detach(thread);
+    }
+  }
+  for (int idx = 1; idx < ACCEPTORS; idx++) {
+    pthread_t thread;
+    dthread_create(&thread, NULL, acceptor, servers[idx % servers.size()]);
+    dthread_detach(thread);
   }
+  acceptor(servers[0]);
 }
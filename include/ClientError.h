@@ -17,6 +17,11 @@ class ClientError : public std::runtime_error {
   static ClientError notFound() { return ClientError("Not Found", 404); }
   static ClientError methodNotAllowed() { return ClientError("Method Not Allowed", 405); }
   static ClientError conflict() { return ClientError("Conflict", 409); }
+  static ClientError requestTimeout() { return ClientError("Request Timeout", 408); }
+  static ClientError preconditionFailed() { return ClientError("Precondition Failed", 412); }
+  static ClientError payloadTooLarge() { return ClientError("Payload Too Large", 413); }
+  static ClientError rangeNotSatisfiable() { return ClientError("Range Not Satisfiable", 416); }
+  static ClientError headerFieldsTooLarge() { return ClientError("Request Header Fields Too Large", 431); }
   static ClientError insufficientStorage() { return ClientError("Insufficient Storage", 507); }
 };
 
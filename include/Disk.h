@@ -1,31 +1,96 @@
 #ifndef _DISK_H_
 #define _DISK_H_
 
+#include <atomic>
 #include <string>
 #include <deque>
 
+#include "ufs.h"
+
 struct UndoRecord {
   int blockNumber;
   unsigned char *blockData;
 };
 
+enum DiskOp { DISK_READ, DISK_WRITE, DISK_FSYNC, DISK_OPS };
+enum DiskRegion { DISK_SUPERBLOCK, DISK_INODE_BITMAP, DISK_DATA_BITMAP, DISK_INODE_TABLE, DISK_DATA, DISK_REGIONS };
+
+// bucket i of a latency histogram holds operations that took under
+// 2^i microseconds, the last one everything slower
+#define DISK_LATENCY_BUCKETS (20)
+
+/**
+ * A copy of a Disk's I/O counters, see Disk::stats(). Everything is
+ * indexed by operation and the region of the image the block is in.
+ */
+struct DiskStats {
+  unsigned long ops[DISK_OPS][DISK_REGIONS];
+  unsigned long long bytes[DISK_OPS][DISK_REGIONS];
+  unsigned long long micros[DISK_OPS][DISK_REGIONS];
+  unsigned long latency[DISK_OPS][DISK_REGIONS][DISK_LATENCY_BUCKETS];
+  unsigned long undoRecords;
+
+  unsigned long total(DiskOp op) const;
+  static const char *opName(int op);
+  static const char *regionName(int region);
+  // the upper bound of a latency bucket in seconds, 0 for the last one
+  static double bucketBound(int bucket);
+};
+
 class Disk {
  public:
   Disk(std::string imageFile, int blockSize);
   void readBlock(int blockNumber, void *buffer);
   void writeBlock(int blockNumber, void *buffer);
+
+  /**
+   * Write a block nothing on the disk points at yet, e.g. one set aside
+   * for a file whose data is still arriving. It is never logged for
+   * rollback, so it is safe while another thread has a transaction open.
+   */
+  void writeNewBlock(int blockNumber, void *buffer);
   int numberOfBlocks();
 
   void beginTransaction();
   void commit();
   void rollback();
+
+  /**
+   * How many times rollback() has been called. Anyone caching what is
+   * on the disk can compare it to tell that their copy may have been
+   * undone underneath them.
+   */
+  unsigned long rollbacks() { return rollbackCount; }
+
+  /**
+   * Tells the disk where the file system's regions are so its stats
+   * can tell metadata from data. Until then every block but the
+   * superblock counts as data.
+   */
+  void setLayout(const super_t &super);
+
+  // copies out the counters, which are kept since the disk was opened
+  // and are safe to read from any thread
+  void stats(DiskStats *stats);
   
  private:
+  DiskRegion regionOf(int blockNumber);
+  void record(DiskOp op, int blockNumber, int size, unsigned long long elapsed);
+
   std::string imageFile;
   int blockSize;
   int imageFileSize;
   bool isInTransaction;
+  unsigned long rollbackCount;
   std::deque<struct UndoRecord> undoLog;
+  super_t layout;
+  bool hasLayout;
+
+  std::atomic<unsigned long> ops[DISK_OPS][DISK_REGIONS];
+  std::atomic<unsigned long long> bytes[DISK_OPS][DISK_REGIONS];
+  std::atomic<unsigned long long> micros[DISK_OPS][DISK_REGIONS];
+  std::atomic<unsigned long> latency[DISK_OPS][DISK_REGIONS][DISK_LATENCY_BUCKETS];
+  std::atomic<unsigned long> undoRecords;
 };
 
 #endif
@@ -5,17 +5,48 @@
 #include "LocalFileSystem.h"
 
 #include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+
+// a Range header asking for more pieces than this gets the whole object
+#define RANGE_MAX_PARTS (64)
+
+// what the file system has left and how busy its disk has been, see usage()
+struct FileSystemUsage {
+  int inodes;
+  int freeInodes;
+  int dataBlocks;
+  int freeDataBlocks;
+  DiskStats disk;
+};
 
 class DistributedFileSystemService : public HttpService {
  public:
-  DistributedFileSystemService(std::string driveFile);
+  // with deduplicate on, file blocks that match one already on disk share it instead of taking a new one
+  DistributedFileSystemService(std::string driveFile, bool deduplicate=false);
 
+  virtual void head(HTTPRequest *request, HTTPResponse *response);
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void put(HTTPRequest *request, HTTPResponse *response);
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
+  virtual void move(HTTPRequest *request, HTTPResponse *response);
+  virtual void copy(HTTPRequest *request, HTTPResponse *response);
+
+  // counts the free inodes and data blocks in the bitmaps, waiting out any write in progress
+  void usage(FileSystemUsage *usage);
 
 private:
+  std::string etag(int inodeNumber);
+  int makeDirectories(const std::vector<std::string> &components);
+  std::vector<std::string> destination(HTTPRequest *request);
+
   LocalFileSystem *fileSystem;
+  time_t startTime;
+  // readers share the file system, PUT, DELETE, MOVE and COPY have it to themselves
+  pthread_rwlock_t lock;
 };
 
 #endif
@@ -3,20 +3,63 @@
 
 #include "HttpService.h"
 
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
 #include <string>
 
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+// total bytes of file contents the static cache will hold
+#define FILE_CACHE_BYTES (32 * 1024 * 1024)
+// files larger than this are never cached, they go out with sendfile
+#define FILE_CACHE_MAX_ENTRY_BYTES (1024 * 1024)
+// how long we trust a cache entry before we stat the file again
+#define FILE_CACHE_REVALIDATE_SECONDS (1)
+
+struct CachedFile {
+  std::shared_ptr<const std::string> contents;
+  std::string etag;
+  time_t mtime;
+  off_t size;
+  ino_t inode;
+  time_t lastChecked;
+  std::list<std::string>::iterator lruPosition;
+};
+
 class FileService : public HttpService {
  public:
-  FileService(std::string basedir);
-
+  FileService(std::string basedir, size_t cacheBytes = FILE_CACHE_BYTES);
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void head(HTTPRequest *request, HTTPResponse *response);
 
+  // how often a request found its file in the cache
+  unsigned long cacheHits() { return m_cacheHits; }
+  unsigned long cacheMisses() { return m_cacheMisses; }
+
 private:
   bool endswith(std::string str, std::string suffix);
-  std::string readFile(std::string path);
+  int openFile(std::string path, struct stat *st);
+  std::string readFile(int fd, size_t size);
+  bool notModified(HTTPRequest *request, std::string etag, time_t mtime);
+
+  bool cacheLookup(std::string path, CachedFile *file);
+  void cacheInsert(std::string path, CachedFile file);
+  void cacheErase(std::map<std::string, CachedFile>::iterator iter);
 
   std::string m_basedir;
+
+  // LRU cache of small static files, most recently used at the front
+  pthread_mutex_t m_cacheLock;
+  std::map<std::string, CachedFile> m_cache;
+  std::list<std::string> m_lru;
+  size_t m_cacheBytes;
+  size_t m_cacheCapacity;
+  std::atomic<unsigned long> m_cacheHits;
+  std::atomic<unsigned long> m_cacheMisses;
 };
 
 #endif
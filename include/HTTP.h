@@ -3,10 +3,64 @@
 
 #include "http_parser.h"
 
+#include <ostream>
 #include <string>
 #include <vector>
 #include <map>
 
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+// header text a request can hold before the arena spills to the heap
+#define HTTP_ARENA_INLINE_BYTES (4096)
+// a request with more header lines than this is rejected as malformed
+#define HTTP_MAX_HEADERS (100)
+
+/**
+ * A read-only piece of request text that points into the HTTP object it
+ * came from instead of owning a copy. It stays valid as long as that
+ * object does; use str() when a std::string is really needed.
+ */
+class StringSlice {
+ public:
+    StringSlice() : m_data(""), m_size(0) {}
+    StringSlice(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+    const char *data() const {return m_data;}
+    size_t size() const {return m_size;}
+    bool empty() const {return m_size == 0;}
+    std::string str() const {return std::string(m_data, m_size);}
+
+    bool startsWith(const std::string &prefix) const {
+      return prefix.size() <= m_size && memcmp(m_data, prefix.data(), prefix.size()) == 0;
+    }
+    bool equals(const char *s) const {
+      return strlen(s) == m_size && memcmp(m_data, s, m_size) == 0;
+    }
+    bool equalsIgnoreCase(const char *s) const {
+      return strlen(s) == m_size && strncasecmp(m_data, s, m_size) == 0;
+    }
+
+ private:
+    const char *m_data;
+    size_t m_size;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const StringSlice &slice) {
+    return out.write(slice.data(), slice.size());
+}
+
+/**
+ * Receives request body bytes as the parser produces them, instead of
+ * having HTTP buffer the whole body.
+ */
+class HttpBodySink {
+ public:
+    virtual ~HttpBodySink() {}
+    virtual void onBody(const char *data, size_t length) = 0;
+};
+
 class HTTP {
  public:
     typedef enum {INIT, HEADER, FIELD, VALUE, BODY, DONE} HttpState;
@@ -20,8 +74,18 @@ class HTTP {
     std::string getProxyRequest(const char *userAgent = NULL);
     std::string getReplyHeader();
     std::string getHost();
-    std::string getUrl();
-    std::string getPath();
+
+    // the request line and headers, valid once isHeaderDone()
+    StringSlice getUrl() {return slice(m_url);}
+    StringSlice getPath() {return slice(m_path);}
+    StringSlice getQuery() {return slice(m_query);}
+    size_t getHeaderCount() {return m_headerCount;}
+    StringSlice getHeaderField(size_t idx) {return slice(m_headers[idx].field);}
+    StringSlice getHeaderValue(size_t idx) {return slice(m_headers[idx].value);}
+    // looks a header up by name, ignoring case; the first one wins if the
+    // request repeats it
+    bool findHeader(const char *field, StringSlice *value);
+
     bool isConnect() {return m_method == HTTP_CONNECT;}
     bool isHead() {return m_method == HTTP_HEAD;}
     bool isGet() {return m_method == HTTP_GET;}
@@ -29,13 +93,33 @@ class HTTP {
     bool isPost() {return m_method == HTTP_POST;}
     bool isDelete() {return m_method == HTTP_DELETE;}
     bool isMove() {return m_method == HTTP_MOVE;}
-    std::string getBody();
-    std::string getQuery() {return m_query;}
-    std::vector< std::pair< std::string *, std::string *> > getHeaders() {
-      return m_headers;
-    }
+    bool isCopy() {return m_method == HTTP_COPY;}
+    // the method as it appeared on the request line, e.g. "GET"
+    const char *getMethodName() {return http_method_str((enum http_method) m_method);}
+    const std::string &getBody();
+    // the declared Content-Length, or -1 if the request didn't send one
+    int64_t getContentLength() {return m_contentLength;}
+    // body bytes parsed from here on go to sink, anything already
+    // buffered is handed over first
+    void setBodySink(HttpBodySink *sink);
+
+    // caps on the header text and the body, zero and -1 mean no cap; going
+    // over either fails the parse and sets the matching flag below
+    void setLimits(size_t maxHeaderBytes, int64_t maxBodyBytes);
+    bool isHeaderTooLarge() {return m_headerTooLarge;}
+    bool isBodyTooLarge() {return m_bodyTooLarge;}
   
  private:
+    // a piece of the arena, by offset so the arena can move when it spills
+    struct Span {
+      uint32_t offset;
+      uint32_t length;
+    };
+    struct HeaderSpan {
+      Span field;
+      Span value;
+    };
+
     static int message_begin_cb(http_parser *parser);
     static int path_cb(http_parser *parser, const char *at, size_t length);
     static int query_string_cb(http_parser *parser, const char *at, size_t length);
@@ -49,27 +133,45 @@ class HTTP {
 
     HttpState getState();
     void setState(HttpState newState);
-    void appendUrl(const char *at, size_t len);
-    void newHeaderField(const char *at, size_t len);
+    bool newHeaderField(const char *at, size_t len);
     void appendHeaderField(const char *at, size_t len);
     void appendHeaderValue(const char *at, size_t len);
-    void addHeaderField();
+    void indexHeaders();
     void messageComplete(unsigned char method);
 
+    void append(Span *span, const char *at, size_t len);
+    const char *arena() {return m_spilled ? m_spill.data() : m_inline;}
+    StringSlice slice(const Span &span) {return StringSlice(arena() + span.offset, span.length);}
+
     http_parser_settings m_settings;
     http_parser m_parser;
     HttpState m_state;
     bool m_doneParsing;
+    bool m_failed;
     bool m_headerDone;
 
-    std::string m_url;
-    std::string m_path;
-    std::string m_query;
-    std::string m_host;
-    std::string *m_field;
-    std::string *m_value;
-    std::vector< std::pair< std::string *, std::string *> > m_headers;
+    // every piece of request text lives in one arena, inline until it
+    // outgrows HTTP_ARENA_INLINE_BYTES
+    char m_inline[HTTP_ARENA_INLINE_BYTES];
+    std::string m_spill;
+    bool m_spilled;
+    size_t m_arenaSize;
+
+    Span m_url;
+    Span m_path;
+    Span m_query;
+    HeaderSpan m_headers[HTTP_MAX_HEADERS];
+    size_t m_headerCount;
+    // header positions sorted by field name, built once at the end of the headers
+    uint8_t m_headerIndex[HTTP_MAX_HEADERS];
     std::string m_body;
+    HttpBodySink *m_bodySink;
+    int64_t m_contentLength;
+    int64_t m_bodyBytes;
+    size_t m_maxHeaderBytes;
+    int64_t m_maxBodyBytes;
+    bool m_headerTooLarge;
+    bool m_bodyTooLarge;
     std::string m_statusStr;
     unsigned char m_method;
     http_parser_type m_httpType;
@@ -12,6 +12,10 @@
 #include <string>
 #include <vector>
 
+// how much we ask the socket for at a time; the buffer is shared by all
+// requests on a thread since the parser consumes it straight away
+#define HTTP_READ_BUFFER_BYTES (64 * 1024)
+
 class HTTPRequest {
 public:
   HTTPRequest(MySocket *sock, int serverPort);
@@ -19,12 +23,48 @@ public:
   
   bool readRequest();
 
+  /**
+   * Caps on the header text and the body, see HTTP::setLimits. Going
+   * over one makes reads throw a ClientError with 431 or 413.
+   */
+  void setLimits(size_t maxHeaderBytes, int64_t maxBodyBytes) {m_http->setLimits(maxHeaderBytes, maxBodyBytes);}
+
+  /**
+   * Read only up to the end of the headers. The body, if any, stays on
+   * the socket until getBody(), readBody() or discardBody() pulls it in.
+   */
+  bool readHeaders();
+
+  /**
+   * Stream the rest of the body into sink as it arrives from the socket,
+   * without buffering it. A body that misses the read deadline throws
+   * ClientError::requestTimeout().
+   */
+  void readBody(HttpBodySink *sink);
+
+  /**
+   * Read and drop whatever is left of the body, so closing the
+   * connection doesn't reset it before the client reads our response.
+   */
+  void discardBody();
+  bool isDone() {return m_http->isDone();}
+  int64_t getContentLength() {return m_http->getContentLength();}
+
   std::string getHost();
   std::string getRequest();
-  std::string getUrl();
-  std::string getPath();
+
+  // slices of the request text, valid for the life of the request
+  StringSlice getUrl();
+  StringSlice getPath();
   std::vector<std::string> getPathComponents();
-  std::string getHeader(std::string key);
+
+  /**
+   * Header lookups ignore the case of the name. findHeader returns false
+   * if the header is missing, getHeader throws.
+   */
+  bool findHeader(const char *key, StringSlice *value);
+  std::string getHeader(const char *key);
+  bool hasHeader(const char *key);
   bool hasAuthToken();
   std::string getAuthToken();
   bool isConnect();
@@ -34,14 +74,18 @@ public:
   bool isPost() {return m_http->isPost();}
   bool isDelete() {return m_http->isDelete();}
   bool isMove() {return m_http->isMove();}
+  bool isCopy() {return m_http->isCopy();}
+  const char *getMethodName() {return m_http->getMethodName();}
   std::map<std::string, std::string> getParams();
   WwwFormEncodedDict formEncodedBody();
-  std::string getBody() {return m_http->getBody();}
+  const std::string &getBody();
   
   void printDebugInfo();
     
  protected:
     void onRead(const char *buffer, unsigned int len);
+    void readMore();
+    void readBodyBytes();
 
     MySocket *m_sock;
     HTTP *m_http;
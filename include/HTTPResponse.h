@@ -2,26 +2,90 @@
 #define HTTP_RESPONSE_H_
 
 #include <map>
+#include <memory>
 #include <string>
 
+#include "MySocket.h"
+
+// bytes pulled from a body source per write
+#define BODY_SOURCE_BUFFER_BYTES (4096)
+
+/**
+ * Produces a response body a piece at a time while it is being sent, so
+ * the whole body never has to sit in memory.
+ */
+class HttpBodySource {
+ public:
+  virtual ~HttpBodySource() {}
+
+  // fill buffer with up to size bytes, return how many, 0 at the end or
+  // < 0 if the body can't be produced
+  virtual int read(void *buffer, int size) = 0;
+};
+
 class HTTPResponse {
  public:
   HTTPResponse();
+  ~HTTPResponse();
   void withStreaming();
   void setHeader(std::string name, std::string value);
-  void setBody(std::string data);
   void setContentType(std::string contentType);
   void setStatus(int status);
   int getStatus();
   std::string response();
 
+  /**
+   * Set the body. The string is moved into the response, so pass
+   * temporaries or std::move the argument to avoid a copy.
+   */
+  void setBody(std::string data);
+
+  /**
+   * Share an immutable buffer, e.g. a cache entry, as the body without
+   * copying it.
+   */
+  void setBody(std::shared_ptr<const std::string> data);
+
+  /**
+   * Use the first length bytes of an open file as the body. The response
+   * takes ownership of fd and send() hands it to the kernel with
+   * sendfile, so the file contents never pass through user space.
+   */
+  void setBodyFile(int fd, size_t length);
+
+  /**
+   * Pull the body from source while sending. With a length the response
+   * carries a Content-Length, with withStreaming() it is sent chunked.
+   */
+  void setBodySource(std::shared_ptr<HttpBodySource> source, size_t length);
+
+  /**
+   * Keep the headers for the body, including Content-Length, but don't
+   * send the body itself. Used for HEAD requests.
+   */
+  void withoutBody();
+
+  /**
+   * Write the response to the client. Headers and an in-memory body go
+   * out together in a single writev.
+   */
+  void send(MySocket *client);
+
  private:
-  std::string statusToString();
+  const char *statusToString();
+  const std::string &header();
+  void clearBody();
+  void sendSource(MySocket *client);
 
   int status;
   bool streaming;
+  bool sendBody;
   std::map<std::string, std::string> headers;
-  std::string body;
+  const char *bodyData;
+  size_t bodyLength;
+  std::shared_ptr<const void> bodyOwner;
+  int bodyFd;
+  std::shared_ptr<HttpBodySource> bodySource;
   std::string contentType;
 };
 
@@ -6,6 +6,10 @@
 #include <stdexcept>
 #include <vector>
 #include <map>
+#include <utility>
+
+#include <stdint.h>
+#include <time.h>
 
 #include "MySocket.h"
 
@@ -22,6 +26,23 @@ class HttpUtils {
 
   static std::vector<std::string> split(const std::string &s, char delim);
 
+  // RFC 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+  static std::string formatDate(time_t when);
+  static bool parseDate(std::string date, time_t *when);
+
+  // true if an If-None-Match / If-Match header value lists etag or is "*".
+  // etagMatches is the weak comparison If-None-Match uses, If-Match needs
+  // the strong one
+  static bool etagMatches(std::string headerValue, std::string etag);
+  static bool strongEtagMatches(std::string headerValue, std::string etag);
+
+  // Parses a Range header against a body of size bytes into sorted,
+  // non-overlapping [first, last] pairs. Returns false if the header
+  // isn't a byte range set we understand, in which case it should be
+  // ignored. An empty result means none of the ranges are satisfiable.
+  static bool parseRange(std::string headerValue, int64_t size,
+			 std::vector<std::pair<int64_t, int64_t> > *ranges);
+
  private:
   static std::vector<std::string> &split(const std::string &s,
 					 char delim,
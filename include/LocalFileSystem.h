@@ -1,7 +1,9 @@
 #ifndef _LOCAL_FILE_SYSTEM_H_
 #define _LOCAL_FILE_SYSTEM_H_
 
+#include <map>
 #include <string>
+#include <vector>
 
 #include "Disk.h"
 #include "ufs.h"
@@ -43,6 +45,42 @@
 #define EINVALIDTYPE       (9)
 // Unlinking '.' or '..'
 #define EUNLINKNOTALLOWED  (10)
+// Moving a directory inside itself
+#define EINVALIDMOVE       (11)
+// Taking a snapshot under a name that is already taken
+#define ESNAPSHOTEXISTS    (12)
+
+// The directory in the root that holds snapshots, see LocalFileSystem::snapshot()
+#define SNAPSHOT_DIRECTORY ".snapshots"
+
+/**
+ * State for a write that arrives a piece at a time, see beginWrite().
+ */
+struct WriteStream {
+  int inodeNumber;
+  int size;                           // total bytes the file will hold
+  int written;                        // bytes appended so far
+  super_t super;
+  inode_t inode;
+  std::vector<unsigned char> dataBitmap;
+  std::vector<int> blocks;            // data blocks the new contents go to
+  std::vector<bool> reused;           // blocks[i] was already in use and holds the same bytes, see setDeduplicate()
+  std::vector<unsigned long long> fingerprints; // the hash of each block when deduplicating
+  unsigned char block[UFS_BLOCK_SIZE]; // the partially filled current block
+  unsigned long long hash;            // FNV-1a of the bytes appended so far
+  bool unchanged;                     // set by endWrite if the contents were the same
+  std::vector<int> staged;            // blocks stageWrite marked in use, see abortWrite()
+};
+
+/**
+ * What we know about an inode's contents beyond what is on disk, see
+ * LocalFileSystem::generation().
+ */
+struct InodeVersion {
+  unsigned long long generation;
+  bool hashKnown;
+  unsigned long long hash;
+};
 
 class LocalFileSystem {
  public:
@@ -99,6 +137,53 @@ class LocalFileSystem {
    */
   int write(int inodeNumber, const void *buffer, int size);
 
+  /**
+   * Write the contents of a file without having all of it in memory.
+   *
+   * beginWrite checks the inode and reserves blocks for exactly `size`
+   * bytes, appendWrite copies data into those blocks and writes each one
+   * out as soon as it fills up, or once the last byte is in, and endWrite
+   * switches the inode over to the new blocks. Nothing is visible until
+   * endWrite, and write() is built from the same three calls.
+   *
+   * Success: beginWrite and appendWrite return 0, endWrite returns the
+   * number of bytes written
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+   * Failure modes: the same as write(), plus appending more than `size`
+   * bytes or ending the write before all `size` bytes have arrived.
+   *
+   * If the new contents are the same as the old ones, endWrite leaves
+   * the inode and bitmaps alone and sets stream->unchanged. It only
+   * checks when the old contents' hash is already known, and confirms a
+   * matching hash by comparing the blocks.
+   */
+  int beginWrite(int inodeNumber, int size, WriteStream *stream);
+  int appendWrite(WriteStream *stream, const void *buffer, int size);
+  int endWrite(WriteStream *stream);
+
+  /**
+   * A streaming write whose data arrives before the file it goes to is
+   * settled, so it needn't hold up the rest of the file system.
+   *
+   * stageWrite marks blocks for `size` bytes as in use, a change to the
+   * disk like any other. appendWrite then fills them without any lock,
+   * since no inode points at them and nothing else will allocate them.
+   * commitWrite points inodeNumber at them, looking at the file system
+   * as it is by then. abortWrite gives them back if the write goes no
+   * further, or if the transaction commitWrite ran in is rolled back.
+   * Blocks staged when the process dies stay marked in use.
+   *
+   * With deduplication on, appendWrite only matches blocks within the
+   * write itself, commitWrite looks for blocks other files hold.
+   *
+   * Success: stageWrite returns 0, commitWrite the number of bytes written
+   * Failure: stageWrite -EINVALIDSIZE, -ENOTENOUGHSPACE; commitWrite the
+   * same as endWrite.
+   */
+  int stageWrite(int size, WriteStream *stream);
+  int commitWrite(int inodeNumber, WriteStream *stream);
+  void abortWrite(WriteStream *stream);
+
   /**
    * Read the contents of a file or directory.
    *
@@ -112,6 +197,19 @@ class LocalFileSystem {
    */
   int read(int inodeNumber, void *buffer, int size);
 
+  /**
+   * Read part of a file or directory you already have the inode for.
+   *
+   * Reads up to `size` bytes starting at byte `offset` into the buffer,
+   * touching only the data blocks that overlap that range. Reading at or
+   * past the end of the file returns 0.
+   *
+   * Success: number of bytes read
+   * Failure: -EINVALIDSIZE.
+   * Failure modes: negative offset or size.
+   */
+  int readAt(inode_t *inode, int offset, void *buffer, int size);
+
   /**
    * Remove a file or directory.
    *
@@ -126,6 +224,75 @@ class LocalFileSystem {
    * a failure by our definition. You can't unlink '.' or '..'
    */
   int unlink(int parentInodeNumber, std::string name);
+
+  /**
+   * Move a file or directory.
+   *
+   * Moves the entry srcName in directory srcParentInodeNumber to dstName
+   * in directory dstParentInodeNumber. Only directory entries change, the
+   * inode and its data blocks stay where they are. An existing entry at
+   * the destination is replaced if it is of the same type, and for a
+   * directory only if it is empty.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -ENOTFOUND, -EINVALIDNAME, -EINVALIDTYPE,
+   *          -EDIRNOTEMPTY, -ENOTENOUGHSPACE, -EUNLINKNOTALLOWED, -EINVALIDMOVE
+   * Failure modes: either parent does not exist or is not a directory,
+   * srcName does not exist, a name is invalid or is '.' or '..', the
+   * destination exists with a different type or is a non-empty
+   * directory, the destination directory needs a block and there is
+   * none, or a directory would be moved inside itself.
+   */
+  int rename(int srcParentInodeNumber, std::string srcName, int dstParentInodeNumber, std::string dstName);
+
+  /**
+   * Copy a file's contents into another file.
+   *
+   * Replaces the contents of dstInodeNumber with those of srcInodeNumber
+   * without copying any data: both inodes point at the same data blocks
+   * afterwards. Writes always put a file's new contents in new blocks, so
+   * the two only go their separate ways when one of them is written, and
+   * a shared block is freed when the last file pointing at it lets go.
+   *
+   * Success: the size of the copy in bytes
+   * Failure: -EINVALIDINODE, -EINVALIDTYPE.
+   * Failure modes: either inode is invalid, or either one is not a
+   * regular file.
+   */
+  int copy(int srcInodeNumber, int dstInodeNumber);
+
+  /**
+   * Take a snapshot of the whole file system.
+   *
+   * Makes /.snapshots/name a copy of everything else under the root as
+   * it is now. Directories are copied, but files share their data blocks
+   * with the originals as with copy(), so a snapshot needs an inode for
+   * every file and directory and a block for every directory, whatever
+   * the size of the files. Snapshots are not themselves included in
+   * later snapshots. Nothing stops writes to a snapshot at this level,
+   * callers that want them read-only have to refuse them.
+   *
+   * A snapshot that fails part way is left behind half made, so do this
+   * inside a transaction and roll it back on failure.
+   *
+   * Success: the inode number of the snapshot's directory
+   * Failure: -EINVALIDNAME, -ESNAPSHOTEXISTS, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+   * Failure modes: the name is invalid, a snapshot with the name exists,
+   * /.snapshots exists but is not a directory, or there aren't enough
+   * inodes or blocks for the copy.
+   */
+  int snapshot(std::string name);
+
+  /**
+   * Remove a snapshot taken with snapshot(), freeing the inodes and
+   * directory blocks it used and any data blocks only it points at.
+   *
+   * Success: 0
+   * Failure: -EINVALIDNAME, -ENOTFOUND, and the failures of unlink().
+   * Failure modes: the name is invalid or there is no snapshot called
+   * name.
+   */
+  int removeSnapshot(std::string name);
   
   /**
    * Some helper functions that you need to implement and use in your
@@ -135,6 +302,33 @@ class LocalFileSystem {
    */
   void readSuperBlock(super_t *super);
 
+  /**
+   * Version information for an inode. inode_t has no room for it, so it
+   * lives in memory and only covers changes made through this object.
+   *
+   * generation() changes whenever the inode is created, removed or its
+   * contents are replaced, and is 0 for inodes untouched since this object was
+   * made.
+   */
+  unsigned long long generation(int inodeNumber);
+
+  /**
+   * Turns block deduplication for writes on or off, it is off to start with.
+   *
+   * While it is on, every block a write fills is hashed (XXH64) and
+   * looked up among the blocks files already hold. If one has the same
+   * bytes, the file points at it instead of getting a block of its own,
+   * and the block is shared as with copy(). A hash match is only a hint:
+   * the candidate block is read back and compared before it is used.
+   *
+   * The index of block hashes is not stored anywhere. Turning
+   * deduplication on builds it by reading every file block, so do it at
+   * start-up rather than in the middle of a transaction. After that it
+   * is kept up to date as blocks are written and freed. Turning it off
+   * drops the index.
+   */
+  void setDeduplicate(bool deduplicate);
+
   /**
    * numDataBytesNeeded is converted to blocks and added to numDataBlocksNeeded
    * Having two separate arguments for data helps for operations that write
@@ -155,6 +349,43 @@ class LocalFileSystem {
   // it in a function you add that is not part of the LocalFileSystem object but
   // can still access the disk.
   Disk *disk;
+
+ private:
+  void newGeneration(int inodeNumber);
+  int entryIndex(inode_t *directory, const std::string &name);
+  void readEntry(inode_t *directory, int index, dir_ent_t *entry);
+  void writeEntry(inode_t *directory, int index, const dir_ent_t *entry);
+  void loadSharedBlocks(super_t *super);
+  bool releaseBlock(super_t *super, unsigned char *dataBitmap, int blockAddress);
+  int readEntries(int inodeNumber, std::vector<dir_ent_t> *entries);
+  int copyTree(int srcInodeNumber, int dstInodeNumber);
+  int removeTree(int parentInodeNumber, const std::string &name);
+  int chooseBlocks(int size, WriteStream *stream);
+  int finishWrite(WriteStream *stream);
+  void storeBlock(WriteStream *stream, int blockIndex);
+  bool sameContents(WriteStream *stream);
+  int findBlock(WriteStream *stream, int blockIndex, unsigned long long fingerprint);
+  void matchStagedBlocks(WriteStream *stream);
+  void rememberFingerprint(unsigned long long fingerprint, int blockAddress);
+  void forgetFingerprint(int blockAddress);
+
+  std::map<int, InodeVersion> versions;
+  unsigned long long lastGeneration;
+
+  // Data blocks that more than one inode points at, and how many other inodes
+  // point at them besides the first. Nothing on disk records this, so it is
+  // counted from the inode table the first time it's needed and again after
+  // the disk rolls a transaction back.
+  std::map<int, int> sharedBlocks;
+  bool sharedBlocksLoaded;
+  unsigned long sharedBlocksRollbacks;
+
+  // Hashes of file data blocks and the other way around, for deduplication.
+  // Loaded along with sharedBlocks, and only while deduplication is on
+  bool deduplicate;
+  bool fingerprintsLoaded;
+  std::map<unsigned long long, int> fingerprintBlocks;
+  std::map<int, unsigned long long> blockFingerprints;
 };  
 
 #endif
@@ -0,0 +1,70 @@
+#ifndef _METRICSSERVICE_H_
+#define _METRICSSERVICE_H_
+
+#include "HttpService.h"
+#include "FileService.h"
+#include "DistributedFileSystemService.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// upper bounds of the request latency buckets, in seconds
+#define METRICS_LATENCY_BOUNDS {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10}
+#define METRICS_LATENCY_BUCKETS (14)
+// methods and statuses get a slot each, anything else shares an "other" slot
+#define METRICS_METHODS {"GET", "HEAD", "PUT", "POST", "DELETE", "MOVE", "COPY"}
+#define METRICS_METHOD_SLOTS (8)
+#define METRICS_STATUSES {200, 206, 304, 400, 401, 403, 404, 405, 408, 409, 412, 413, 416, 431, 500, 501, 503, 507}
+#define METRICS_STATUS_SLOTS (19)
+
+/**
+ * Serves /metrics in the Prometheus text format: request counts and
+ * latency histograms by method and status, whatever server counters and
+ * gauges have been registered, file system usage and disk I/O from the
+ * distributed file system, and the static file cache's hit counts.
+ * When the server traces requests, /metrics/trace dumps the trace ring
+ * as Chrome trace JSON.
+ *
+ * Everything recorded on the request path is a relaxed atomic, so
+ * workers never contend on a lock to be counted.
+ */
+class MetricsService : public HttpService {
+ public:
+  MetricsService(DistributedFileSystemService *dfs, FileService *files);
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+  virtual void head(HTTPRequest *request, HTTPResponse *response);
+
+  // called once per request after its response has gone out
+  void recordRequest(const char *method, int status, double seconds);
+
+  // exported under name as they read when /metrics is fetched; the
+  // values have to outlive the service
+  void addCounter(std::string name, std::string help, const std::atomic<unsigned long> *value);
+  void addGauge(std::string name, std::string help, const std::atomic<int> *value);
+
+ private:
+  struct Histogram {
+    std::atomic<unsigned long> buckets[METRICS_LATENCY_BUCKETS + 1];
+    std::atomic<unsigned long long> sumMicros;
+  };
+  struct Export {
+    std::string name;
+    std::string help;
+    const std::atomic<unsigned long> *counter;
+    const std::atomic<int> *gauge;
+  };
+
+  int methodSlot(const char *method);
+  int statusSlot(int status);
+  void writeRequests(std::string *out);
+  void writeStorage(std::string *out);
+  void writeDisk(std::string *out, const DiskStats &stats);
+
+  DistributedFileSystemService *m_dfs;
+  FileService *m_files;
+  Histogram m_requests[METRICS_METHOD_SLOTS][METRICS_STATUS_SLOTS];
+  std::vector<Export> m_exports;
+};
+
+#endif
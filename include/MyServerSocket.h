@@ -13,8 +13,21 @@ class MyServerSocket {
    * if it cannot bind, it will throw a socket exception.
    *
    * @param port the port to bind to
+   * @param backlog how many connections the kernel queues for accept()
+   * @param reusePort set SO_REUSEPORT so several sockets can bind the
+   *        same port and the kernel spreads connections across them
    */
-  MyServerSocket(int port);
+  MyServerSocket(int port, int backlog = 10, bool reusePort = false);
+
+  /**
+   * creates a server socket listening on the unix domain socket at
+   * path, for clients on the same host. A socket file left behind at
+   * path by an earlier run is replaced; any other file is not.
+   *
+   * @param path where the socket appears in the file system
+   * @param backlog how many connections the kernel queues for accept()
+   */
+  MyServerSocket(const std::string &path, int backlog = 10);
   MyServerSocket() { serverFd = -1; }
   
   /**
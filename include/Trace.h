@@ -0,0 +1,68 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <string>
+
+// Per-request tracing. Once trace_enable() has been called, every span
+// a thread records between trace_begin_request() and trace_end_request()
+// lands in one fixed-size ring of compact binary events, overwriting the
+// oldest when it is full. trace_dump_json() renders whatever the ring
+// holds as Chrome trace JSON (chrome://tracing, Perfetto).
+//
+// Threads that aren't inside a traced request record nothing, so a
+// span costs a thread_local check when tracing is off.
+
+enum TracePhase {
+  TRACE_QUEUE,          // accepted, waiting for a worker
+  TRACE_HEADERS,        // reading and parsing the request headers
+  TRACE_BODY,           // reading the request body
+  TRACE_SERVICE,        // the service handling the request
+  TRACE_RESPONSE,       // writing the response
+  TRACE_LOOKUP,         // LocalFileSystem::lookup, arg is the parent inode
+  TRACE_CREATE,         // LocalFileSystem::create, arg is the parent inode
+  TRACE_WRITE,          // a whole or streamed file write, arg is the inode
+  TRACE_UNLINK,         // LocalFileSystem::unlink, arg is the parent inode
+  TRACE_RENAME,         // LocalFileSystem::rename, arg is the source parent inode
+  TRACE_COPY,           // LocalFileSystem::copy, arg is the destination inode
+  TRACE_SUPERBLOCK,     // loading the superblock
+  TRACE_INODE_BITMAP,   // loading (arg 0) or storing (arg 1) the inode bitmap
+  TRACE_DATA_BITMAP,    // loading (arg 0) or storing (arg 1) the data bitmap
+  TRACE_INODE_TABLE,    // loading (arg 0) or storing (arg 1) the inode table
+  TRACE_BLOCK_READ,     // Disk::readBlock, arg is the block
+  TRACE_BLOCK_WRITE,    // Disk::writeBlock including its fsync, arg is the block
+  TRACE_FSYNC,          // the fsync inside a block write, arg is the block
+  TRACE_COMMIT,         // Disk::commit
+  TRACE_ROLLBACK,       // Disk::rollback
+  TRACE_PHASES
+};
+
+// sizes the ring and turns tracing on, call before any threads start
+void trace_enable(size_t events);
+bool trace_enabled();
+
+// monotonic nanoseconds, the clock every event uses
+uint64_t trace_now();
+
+// the calling thread works for a new request until trace_end_request()
+void trace_begin_request();
+void trace_end_request();
+
+// records a span whose start was taken earlier with trace_now()
+void trace_record(TracePhase phase, uint64_t start, int64_t arg = -1);
+
+// records the span from construction to destruction
+class TraceSpan {
+ public:
+  TraceSpan(TracePhase phase, int64_t arg = -1);
+  ~TraceSpan();
+
+ private:
+  TracePhase phase;
+  int64_t arg;
+  uint64_t start;
+};
+
+void trace_dump_json(std::string *out);
+
+#endif
@@ -17,7 +17,7 @@ int dthread_cond_broadcast(pthread_cond_t *cond);
 
 
 // don't use these, they're used by the autograder
-void sync_print(std::string function, std::string payload);
+void sync_print(const std::string &function, const std::string &payload);
 void set_log_file(std::string file_name);
 
 #endif
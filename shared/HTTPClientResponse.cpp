@@ -4,49 +4,179 @@
 #include <string>
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <strings.h>
 
 #include <sstream>
 
 using namespace std;
 
+// how much we ask the socket for at a time
+#define CLIENT_READ_BUFFER_BYTES (16 * 1024)
+
 HTTPClientResponse::HTTPClientResponse(MySocket *sock) {
     m_sock = sock;
+    m_pending = &m_own_pending;
+    m_head_request = false;
+    m_keep_alive = false;
     m_status_code = 0;
 }
 
+HTTPClientResponse::HTTPClientResponse(MySocket *sock, string *pending, bool head_request) {
+    m_sock = sock;
+    m_pending = pending;
+    m_head_request = head_request;
+    m_keep_alive = false;
+    m_status_code = 0;
+}
 
-string HTTPClientResponse::readResponse() {
-  string full_response;
+// appends whatever the socket has to the pending bytes, false once the
+// connection is closed or broken
+bool HTTPClientResponse::fill() {
+  char buffer[CLIENT_READ_BUFFER_BYTES];
+  try {
+    size_t len = m_sock->read(buffer, sizeof(buffer));
+    m_pending->append(buffer, len);
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
 
-  while (true) {
-    string response;
-    try {
-      response = m_sock->read();
-    } catch (...) {
-      break;
+bool HTTPClientResponse::fillTo(size_t bytes) {
+  while (m_pending->size() < bytes) {
+    if (!fill()) {
+      return false;
     }
+  }
+  return true;
+}
 
-    full_response += response;
+string HTTPClientResponse::header(string name) {
+  for (size_t idx = 0; idx < name.size(); idx++) {
+    name[idx] = tolower(name[idx]);
   }
+  map<string, string>::iterator iter = m_headers.find(name);
+  return iter == m_headers.end() ? "" : iter->second;
+}
 
-  size_t delimiter = full_response.find("\r\n\r\n");
-  if (delimiter == string::npos) {
-    return "";
+string HTTPClientResponse::readResponse() {
+  size_t delimiter;
+  while ((delimiter = m_pending->find("\r\n\r\n")) == string::npos) {
+    if (!fill()) {
+      return "";
+    }
   }
 
-  m_body = full_response.substr(delimiter+4);
-  string header_string = full_response.substr(0, delimiter);
+  string header_string = m_pending->substr(0, delimiter);
+  m_pending->erase(0, delimiter + 4);
   stringstream header_stream(header_string);
 
-  string line;
+  // the status line, then one header per line with names kept in lower case
+  int status_code = 0;
+  string version, line;
+  if (getline(header_stream, line)) {
+    stringstream status_line(line);
+    status_line >> version >> status_code;
+    getline(status_line >> ws, m_status_message);
+    if (!m_status_message.empty() && m_status_message[m_status_message.size() - 1] == '\r') {
+      m_status_message.erase(m_status_message.size() - 1);
+    }
+  }
   while (getline(header_stream, line)) {
-    if (line.find("HTTP/1.1 ") == 0 || line.find("HTTP/1.0") == 0) {
-      stringstream header_line(line);
-      string http;
-      header_line >> http >> m_status_code >> m_status_message;
+    size_t colon = line.find(':');
+    if (colon == string::npos) {
+      continue;
     }
+    size_t start = line.find_first_not_of(" \t", colon + 1);
+    size_t end = line.find_last_not_of(" \t\r");
+    string name = line.substr(0, colon);
+    for (size_t idx = 0; idx < name.size(); idx++) {
+      name[idx] = tolower(name[idx]);
+    }
+    m_headers[name] = start == string::npos || end < start ? "" : line.substr(start, end - start + 1);
+  }
+
+  if (!readBody(status_code)) {
+    // cut off part way, there's no telling what the rest would have said
+    m_keep_alive = false;
+    return "";
+  }
+  m_status_code = status_code;
+
+  string connection = header("Connection");
+  if (version == "HTTP/1.1") {
+    m_keep_alive = m_keep_alive && strcasecmp(connection.c_str(), "close") != 0;
+  } else {
+    m_keep_alive = m_keep_alive && strcasecmp(connection.c_str(), "keep-alive") == 0;
   }
-  
   return m_body;
 }
+
+// sets m_keep_alive when the body's end is marked in the response itself
+// rather than by the server closing the connection
+bool HTTPClientResponse::readBody(int status_code) {
+  string transfer_encoding = header("Transfer-Encoding");
+  string content_length = header("Content-Length");
+
+  if (m_head_request || status_code == 204 || status_code == 304 || (status_code >= 100 && status_code < 200)) {
+    m_keep_alive = true;
+    return true;
+  }
+
+  if (transfer_encoding.find("chunked") != string::npos) {
+    while (true) {
+      size_t line_end;
+      while ((line_end = m_pending->find("\r\n")) == string::npos) {
+        if (!fill()) {
+          return false;
+        }
+      }
+      size_t chunk = strtoul(m_pending->c_str(), NULL, 16);
+      m_pending->erase(0, line_end + 2);
+      if (chunk == 0) {
+        break;
+      }
+      if (!fillTo(chunk + 2)) {
+        return false;
+      }
+      m_body.append(*m_pending, 0, chunk);
+      m_pending->erase(0, chunk + 2);
+    }
+    // trailers, if any, up to an empty line
+    while (true) {
+      size_t line_end;
+      while ((line_end = m_pending->find("\r\n")) == string::npos) {
+        if (!fill()) {
+          return false;
+        }
+      }
+      m_pending->erase(0, line_end + 2);
+      if (line_end == 0) {
+        break;
+      }
+    }
+    m_keep_alive = true;
+    return true;
+  }
+
+  if (!content_length.empty()) {
+    size_t length = strtoul(content_length.c_str(), NULL, 10);
+    if (!fillTo(length)) {
+      return false;
+    }
+    m_body.append(*m_pending, 0, length);
+    m_pending->erase(0, length);
+    m_keep_alive = true;
+    return true;
+  }
+
+  // neither, so the body runs until the server closes the connection
+  while (fill()) {
+  }
+  m_body.swap(*m_pending);
+  m_pending->clear();
+  return true;
+}
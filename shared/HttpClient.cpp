@@ -3,27 +3,118 @@
 #include "MySslSocket.h"
 #include "Base64.h"
 
-#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
 
 using namespace std;
 
-HttpClient::HttpClient(const char *inet_addr, int port, bool use_tls) {
+static map<string, HttpConnectionPool *> pools;
+static mutex pools_lock;
+
+HttpConnectionPool *HttpConnectionPool::forHost(const string &host, int port, bool use_tls) {
+  char key[32];
+  snprintf(key, sizeof(key), ":%d:%d", port, use_tls ? 1 : 0);
+  lock_guard<mutex> guard(pools_lock);
+  HttpConnectionPool *&pool = pools[host + key];
+  if (pool == NULL) {
+    pool = new HttpConnectionPool(host, port, use_tls);
+  }
+  return pool;
+}
+
+HttpConnectionPool::HttpConnectionPool(const string &host, int port, bool use_tls)
+  : host(host), port(port), use_tls(use_tls), max_idle(HTTP_POOL_MAX_IDLE) {
+}
+
+MySocket *HttpConnectionPool::acquire(bool *reused) {
+  {
+    lock_guard<mutex> guard(lock);
+    if (!idle.empty()) {
+      MySocket *connection = idle.back();
+      idle.pop_back();
+      *reused = true;
+      return connection;
+    }
+  }
+
+  // connect without holding the lock, other clients needn't wait on it
+  *reused = false;
   if (use_tls) {
-    connection = new MySslSocket(inet_addr, port);
+    return new MySslSocket(host.c_str(), port);
+  }
+  return new MySocket(host.c_str(), port);
+}
+
+void HttpConnectionPool::release(MySocket *connection) {
+  {
+    lock_guard<mutex> guard(lock);
+    if (idle.size() < max_idle) {
+      idle.push_back(connection);
+      return;
+    }
+  }
+  delete connection;
+}
+
+void HttpConnectionPool::setMaxIdle(size_t max_idle) {
+  vector<MySocket *> extra;
+  {
+    lock_guard<mutex> guard(lock);
+    this->max_idle = max_idle;
+    while (idle.size() > max_idle) {
+      extra.push_back(idle.back());
+      idle.pop_back();
+    }
+  }
+  for (size_t idx = 0; idx < extra.size(); idx++) {
+    delete extra[idx];
+  }
+}
+
+HttpClient::HttpClient(const char *inet_addr, int port, bool use_tls) {
+  pool = HttpConnectionPool::forHost(inet_addr, port, use_tls);
+  connection = NULL;
+  reused = false;
+  head_request = false;
+  outstanding = 0;
+  connect();
+
+  // a unix domain socket has no host name to speak of
+  char host[300];
+  if (strncmp(inet_addr, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX)) == 0) {
+    snprintf(host, sizeof(host), "localhost");
   } else {
-    connection = new MySocket(inet_addr, port);
+    snprintf(host, sizeof(host), "%s:%d", inet_addr, port);
   }
-  
-  stringstream host;
-  host << inet_addr << ":" << port;
-  headers["Host"] = host.str();
+  headers["Host"] = host;
   headers["User-Agent"] = string("Gunrock/1.0");
   headers["Accept"] = string("*/*");
-  headers["Connection"] = string("close");
 }
 
 HttpClient::~HttpClient() {
+  // only a connection with nothing left in flight can serve someone else
+  if (connection != NULL && outstanding == 0 && pending.empty()) {
+    pool->release(connection);
+  } else {
+    delete connection;
+  }
+}
+
+void HttpClient::connect() {
+  if (connection == NULL) {
+    connection = pool->acquire(&reused);
+    pending.clear();
+    outstanding = 0;
+  }
+}
+
+void HttpClient::disconnect() {
   delete connection;
+  connection = NULL;
+  pending.clear();
+  outstanding = 0;
 }
 
 void HttpClient::set_header(string key, string value) {
@@ -37,57 +128,190 @@ void HttpClient::set_basic_auth(string username, string password) {
   set_header("Authorization", value);
 }
 
-void HttpClient::write_request(string path, string method, string body) {
-  stringstream request;
+// appends the request line and headers to the request buffer
+void HttpClient::format_request(const string &path, const string &method, size_t body_size) {
+  request.append(method).append(" ").append(path).append(" HTTP/1.1\r\n");
 
-  // PART 1: implement support for handling the body, if it exists
-  request << method << " " << path << " HTTP/1.1\r\n";
-  if (body.size() > 0) {
-    stringstream length;
-    length << body.size();
-    headers["Content-Length"] = length.str();
-  } else {
-    headers.erase("Content-Length");
-  }
-  
   map<string, string>::iterator iter;
   for (iter = headers.begin(); iter != headers.end(); iter++) {
-    request << iter->first << ": " << iter->second << "\r\n";
-  } 
-  
-  request << "\r\n";
-
-  if (body.size() > 0) {
-    request << body;
+    if (strcasecmp(iter->first.c_str(), "Content-Length") != 0) {
+      request.append(iter->first).append(": ").append(iter->second).append("\r\n");
+    }
+  }
+  // a PUT or POST without a body still says so, or the server can't tell
+  // where it ends on a kept-alive connection
+  if (body_size > 0 || method == "PUT" || method == "POST") {
+    char length[64];
+    snprintf(length, sizeof(length), "Content-Length: %zu\r\n", body_size);
+    request.append(length);
   }
-  
-  connection->write(request.str());
+
+  request.append("\r\n");
 }
 
+// the body goes out straight from the caller's string rather than being
+// copied in behind the headers
+void HttpClient::write_request(const string &path, const string &method, const string &body) {
+  connect();
+  request.clear();
+  format_request(path, method, body.size());
 
+  struct iovec iov[2];
+  iov[0].iov_base = (void *) request.data();
+  iov[0].iov_len = request.size();
+  iov[1].iov_base = (void *) body.data();
+  iov[1].iov_len = body.size();
+  connection->writev(iov, body.empty() ? 1 : 2);
+  head_request = method == "HEAD";
+  outstanding++;
+}
 
-HTTPClientResponse *HttpClient::read_response() {
-  HTTPClientResponse *response = new HTTPClientResponse(connection);
+// reads the next response and gives the connection up unless the server
+// means to keep it open
+HTTPClientResponse *HttpClient::receive(bool head_request, bool *nothing_received) {
+  HTTPClientResponse *response = new HTTPClientResponse(connection, &pending, head_request);
   response->readResponse();
+  outstanding--;
+  *nothing_received = response->status() == 0 && pending.empty();
+
+  map<string, string>::iterator iter = headers.find("Connection");
+  bool close_requested = iter != headers.end() && strcasecmp(iter->second.c_str(), "close") == 0;
+  if (!response->keepAlive() || close_requested) {
+    disconnect();
+  }
   return response;
 }
 
+HTTPClientResponse *HttpClient::read_response() {
+  if (connection == NULL) {
+    // the last response closed the connection
+    return new HTTPClientResponse(NULL);
+  }
+  bool nothing_received;
+  return receive(head_request, &nothing_received);
+}
+
+// a pooled connection may have been closed by the server while it sat
+// idle, which shows as a failed write or no response at all; only then
+// is the request sent again, once, on a new connection
+HTTPClientResponse *HttpClient::send(const string &method, const string &path, const string &body) {
+  for (int attempt = 0; ; attempt++) {
+    connect();
+    bool retry = reused && attempt == 0;
+    try {
+      write_request(path, method, body);
+    } catch (SocketWriteError &) {
+      disconnect();
+      if (retry) {
+	continue;
+      }
+      throw;
+    }
+
+    bool nothing_received;
+    HTTPClientResponse *response = receive(method == "HEAD", &nothing_received);
+    if (nothing_received && retry) {
+      delete response;
+      disconnect();
+      continue;
+    }
+    return response;
+  }
+}
+
+vector<HTTPClientResponse *> HttpClient::pipeline(const vector<HttpClientRequest> &requests) {
+  vector<HTTPClientResponse *> responses;
+  bool retried = false;
+  size_t depth = HTTP_PIPELINE_DEPTH;
+
+  while (responses.size() < requests.size()) {
+    connect();
+    size_t first = responses.size();
+    size_t batch = requests.size() - first;
+    if (batch > depth) {
+      batch = depth;
+    }
+
+    // every request's headers go into one buffer, then out in a single
+    // writev with the bodies in between
+    size_t starts[HTTP_PIPELINE_DEPTH + 1];
+    request.clear();
+    for (size_t idx = 0; idx < batch; idx++) {
+      const HttpClientRequest &r = requests[first + idx];
+      starts[idx] = request.size();
+      format_request(r.path, r.method, r.body.size());
+    }
+    starts[batch] = request.size();
+
+    struct iovec iov[2 * HTTP_PIPELINE_DEPTH];
+    int iovcnt = 0;
+    for (size_t idx = 0; idx < batch; idx++) {
+      iov[iovcnt].iov_base = (void *) (request.data() + starts[idx]);
+      iov[iovcnt].iov_len = starts[idx + 1] - starts[idx];
+      iovcnt++;
+      if (!requests[first + idx].body.empty()) {
+	iov[iovcnt].iov_base = (void *) requests[first + idx].body.data();
+	iov[iovcnt].iov_len = requests[first + idx].body.size();
+	iovcnt++;
+      }
+    }
+
+    bool written = true;
+    try {
+      connection->writev(iov, iovcnt);
+      outstanding += batch;
+    } catch (SocketWriteError &) {
+      written = false;
+    }
+
+    // read until the batch is answered or the connection goes away
+    bool fresh = !reused;
+    for (size_t idx = 0; written && idx < batch && connection != NULL; idx++) {
+      bool nothing_received;
+      HTTPClientResponse *response = receive(requests[first + idx].method == "HEAD", &nothing_received);
+      if (response->status() == 0) {
+	delete response;
+	break;
+      }
+      responses.push_back(response);
+
+      // a server that closes after a response, like gunrock_web does
+      // after every one, would only get the rest of a batch resent
+      if (connection == NULL) {
+	depth = 1;
+      }
+    }
+
+    if (responses.size() > first) {
+      retried = false;
+      continue;
+    }
+
+    // not one answer: try a new connection once, then give up on the rest
+    disconnect();
+    if (!fresh && !retried) {
+      retried = true;
+      continue;
+    }
+    while (responses.size() < requests.size()) {
+      responses.push_back(new HTTPClientResponse(NULL));
+    }
+  }
+  return responses;
+}
+
 HTTPClientResponse *HttpClient::get(string path) {
-  write_request(path, "GET", "");
-  return read_response();
+  return send("GET", path, "");
 }
 
 HTTPClientResponse *HttpClient::post(string path, string body) {
-  write_request(path, "POST", body);
-  return read_response();
+  return send("POST", path, body);
 }
 
 HTTPClientResponse *HttpClient::put(string path, string body) {
-  write_request(path, "PUT", body);
-  return read_response();
+  return send("PUT", path, body);
 }
 
 HTTPClientResponse *HttpClient::del(string path) {
-  write_request(path, "DELETE", "");
-  return read_response();
+  return send("DELETE", path, "");
 }
@@ -5,13 +5,30 @@
 #include <string.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <string>
 
+#include <sys/uio.h>
+#ifndef __APPLE__
+#include <sys/sendfile.h>
+#endif
+
 #include <iostream>
 
 using namespace std;
 
-MySocket::MySocket(const char *inetAddr, int port) {
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+MySocket::MySocket(const char *inetAddr, int port)
+  : nonBlocking(false), readDeadline(0), writeDeadline(0) {
   call_connect(inetAddr, port);
 }
 
@@ -20,6 +37,11 @@ void MySocket::call_connect(const char *inetAddr, int port) {
     struct addrinfo hints;
     struct addrinfo *res;
 
+    if(strncmp(inetAddr, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX)) == 0) {
+        call_connect_unix(inetAddr + strlen(UNIX_SOCKET_PREFIX));
+        return;
+    }
+
     // set up the new socket (TCP/IP)
     sockFd = socket(AF_INET,SOCK_STREAM,0);
     
@@ -45,11 +67,31 @@ void MySocket::call_connect(const char *inetAddr, int port) {
     }
 }
 
-MySocket::MySocket(void) {
+void MySocket::call_connect_unix(const char *path) {
+    struct sockaddr_un server;
+
+    if(strlen(path) >= sizeof(server.sun_path)) {
+        throw SocketError("unix socket path is too long");
+    }
+    sockFd = socket(AF_UNIX,SOCK_STREAM,0);
+
+    memset(&server, 0, sizeof(server));
+    server.sun_family = AF_UNIX;
+    strcpy(server.sun_path, path);
+
+    if( connect(sockFd, (struct sockaddr *) &server,
+                sizeof(server)) == -1 ) {
+        throw SocketError("Did not connect to the server");
+    }
+}
+
+MySocket::MySocket(void)
+  : nonBlocking(false), readDeadline(0), writeDeadline(0) {
     sockFd = -1;
 }
 
-MySocket::MySocket(int socketFileDesc) {
+MySocket::MySocket(int socketFileDesc)
+  : nonBlocking(false), readDeadline(0), writeDeadline(0) {
     sockFd = socketFileDesc;
 }
 
@@ -72,6 +114,13 @@ void MySocket::write_bytes(const void *buffer, int len) {
 
     while(len > 0) {
         bytesWritten = ::write(sockFd, buf, len);
+        if(bytesWritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          waitFor(POLLOUT, writeDeadline);
+          continue;
+        }
+        if(bytesWritten < 0 && errno == EINTR) {
+          continue;
+        }
         if(bytesWritten <= 0) {
 	  throw SocketWriteError();
         }
@@ -80,21 +129,160 @@ void MySocket::write_bytes(const void *buffer, int len) {
     }
 }
 
-string MySocket::read() {
-    char buffer[4096];
+void MySocket::sendfile(int fileFd, off_t offset, size_t count) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    while(count > 0) {
+#ifdef __APPLE__
+        off_t bytesSent = count;
+        int ret = ::sendfile(fileFd, sockFd, offset, &bytesSent, NULL, 0);
+        if(ret < 0 && errno != EINTR && errno != EAGAIN) {
+          throw SocketWriteError();
+        }
+        if(ret < 0 && errno == EAGAIN && bytesSent == 0) {
+          waitFor(POLLOUT, writeDeadline);
+        }
+        if(ret == 0 && bytesSent == 0) {
+          // the file ended before count bytes, as ret == 0 does on linux
+          throw SocketWriteError();
+        }
+#else
+        off_t before = offset;
+        ssize_t ret = ::sendfile(sockFd, fileFd, &offset, count);
+        if(ret < 0 && errno == EINTR) {
+          continue;
+        }
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          waitFor(POLLOUT, writeDeadline);
+          continue;
+        }
+        if(ret <= 0) {
+          throw SocketWriteError();
+        }
+        off_t bytesSent = offset - before;
+        offset = before;
+#endif
+        offset += bytesSent;
+        count -= bytesSent;
+    }
+}
+
+void MySocket::writev(const struct iovec *iov, int iovcnt) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    // copy the vector so we can advance it past partial writes
+    struct iovec vec[iovcnt];
+    for (int idx = 0; idx < iovcnt; idx++) {
+        vec[idx] = iov[idx];
+    }
+
+    struct iovec *cur = vec;
+    while(iovcnt > 0) {
+        ssize_t bytesWritten = ::writev(sockFd, cur, iovcnt);
+        if(bytesWritten < 0 && errno == EINTR) {
+          continue;
+        }
+        if(bytesWritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          waitFor(POLLOUT, writeDeadline);
+          continue;
+        }
+        if(bytesWritten < 0) {
+          throw SocketWriteError();
+        }
+        while(iovcnt > 0 && (size_t) bytesWritten >= cur->iov_len) {
+            bytesWritten -= cur->iov_len;
+            cur++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            cur->iov_base = (char *) cur->iov_base + bytesWritten;
+            cur->iov_len -= bytesWritten;
+        }
+    }
+}
+
+size_t MySocket::read(void *buffer, size_t size) {
     if(sockFd<0) {
       throw SocketNotConnected();
     }
-    
-    int ret = ::read(sockFd, buffer, sizeof(buffer));
-    
+
+    ssize_t ret;
+    while(true) {
+        ret = ::read(sockFd, buffer, size);
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          waitFor(POLLIN, readDeadline);
+          continue;
+        }
+        if(ret < 0 && errno == EINTR) {
+          continue;
+        }
+        break;
+    }
+
     if(ret <= 0) {
       throw SocketReadError();
     }
-  
+
+    return ret;
+}
+
+string MySocket::read() {
+    char buffer[4096];
+    size_t ret = read(buffer, sizeof(buffer));
     return string(buffer, ret);
 }
 
+void MySocket::setReadDeadline(int milliseconds) {
+    readDeadline = milliseconds > 0 ? now_ms() + milliseconds : 0;
+    if(milliseconds > 0 && !nonBlocking && sockFd >= 0) {
+        fcntl(sockFd, F_SETFL, fcntl(sockFd, F_GETFL) | O_NONBLOCK);
+        nonBlocking = true;
+    }
+}
+
+void MySocket::setWriteDeadline(int milliseconds) {
+    writeDeadline = milliseconds > 0 ? now_ms() + milliseconds : 0;
+    if(milliseconds > 0 && !nonBlocking && sockFd >= 0) {
+        fcntl(sockFd, F_SETFL, fcntl(sockFd, F_GETFL) | O_NONBLOCK);
+        nonBlocking = true;
+    }
+}
+
+// blocks until the socket is ready for events or the deadline, if
+// there is one, passes
+void MySocket::waitFor(short events, long long deadline) {
+    struct pollfd pfd;
+    pfd.fd = sockFd;
+    pfd.events = events;
+    while(true) {
+        int timeout = -1;
+        if(deadline != 0) {
+            long long remaining = deadline - now_ms();
+            if(remaining <= 0) {
+                throw SocketTimeout();
+            }
+            timeout = (int) remaining;
+        }
+        int ret = poll(&pfd, 1, timeout);
+        if(ret > 0) {
+            return;
+        }
+        if(ret < 0 && errno != EINTR) {
+            throw SocketError("poll failed");
+        }
+    }
+}
+
+void MySocket::shutdownWrite(void) {
+    if(sockFd<0) return;
+
+    ::shutdown(sockFd, SHUT_WR);
+}
+
 void MySocket::close(void) {
     if(sockFd<0) return;
     
@@ -3,6 +3,8 @@
 #include <iostream>
 #include <sstream>
 
+#include <unistd.h>
+
 #include <openssl/conf.h>
 #include <openssl/opensslconf.h>
 
@@ -74,27 +76,47 @@ void MySslSocket::write(string buffer) {
   }
 }
 
-string MySslSocket::read() {
+void MySslSocket::writev(const struct iovec *iov, int iovcnt) {
+  for (int idx = 0; idx < iovcnt; idx++) {
+    if (iov[idx].iov_len > 0) {
+      write(string((const char *) iov[idx].iov_base, iov[idx].iov_len));
+    }
+  }
+}
+
+// TLS has to encrypt in user space, so we can't hand the file to the
+// kernel and fall back to reading it through a buffer instead
+void MySslSocket::sendfile(int fileFd, off_t offset, size_t count) {
   char buffer[4096];
+  while (count > 0) {
+    ssize_t ret = pread(fileFd, buffer, count < sizeof(buffer) ? count : sizeof(buffer), offset);
+    if (ret <= 0) {
+      throw SocketWriteError();
+    }
+    write(string(buffer, ret));
+    offset += ret;
+    count -= ret;
+  }
+}
+
+size_t MySslSocket::read(void *buffer, size_t size) {
   if(sockFd<0 || ssl == NULL) {
     throw SocketNotConnected();
   }
     
-  int ret = SSL_read(ssl, buffer, sizeof(buffer));
+  int ret = SSL_read(ssl, buffer, size);
   
   if(ret <= 0) {
     throw SocketReadError();
   }
 
-  string result = string(buffer, ret);
-  
   if (debug_print_io) {
     cout << "MySslSocket::read" << endl;
     cout << "-----------------" << endl;
-    cout << result << endl << endl;
+    cout << string((const char *) buffer, ret) << endl << endl;
   }
   
-  return result;
+  return ret;
 }
 
 void MySslSocket::close() {
@@ -8,14 +8,56 @@
 
 class HTTPClientResponse {
  public:
-  HTTPClientResponse(MySocket *sock);    
+  HTTPClientResponse(MySocket *sock);
+
+  /**
+   * Reads a response off a connection that may carry more than one.
+   *
+   * Bytes already read from sock are taken from the front of pending,
+   * and anything read past the end of this response is left there for
+   * the next one.
+   *
+   * @param sock the connection to read from
+   * @param pending the connection's read-ahead buffer
+   * @param head_request the request was a HEAD, so there is no body
+   *        whatever the headers say
+   */
+  HTTPClientResponse(MySocket *sock, std::string *pending, bool head_request=false);
+
+  /**
+   * Reads one response, framed by its Content-Length or chunked
+   * encoding, or by the server closing the connection if it has
+   * neither. If the connection fails before the response is complete
+   * status() stays 0.
+   */
   std::string readResponse();
   int status() { return m_status_code; }
   bool success() { return m_status_code >= 200 && m_status_code < 300; }
   std::string body() { return m_body; }
-  
+
+  /**
+   * Looks a header up by name, ignoring case. Returns "" if the response
+   * doesn't have it.
+   */
+  std::string header(std::string name);
+
+  /**
+   * Whether the connection can carry another request: the response was
+   * complete, its end was marked without closing the connection and
+   * the server didn't ask to close it.
+   */
+  bool keepAlive() { return m_keep_alive; }
+
  protected:
+  bool fill();
+  bool fillTo(size_t bytes);
+  bool readBody(int status_code);
+
   MySocket *m_sock;
+  std::string *m_pending;
+  std::string m_own_pending;
+  bool m_head_request;
+  bool m_keep_alive;
   std::string m_body;
   std::map<std::string, std::string> m_headers;
   int m_status_code;
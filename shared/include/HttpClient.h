@@ -3,10 +3,62 @@
 
 #include <string>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include "HTTPClientResponse.h"
 #include "MySocket.h"
 
+// idle connections a pool keeps for each host unless told otherwise
+#define HTTP_POOL_MAX_IDLE (16)
+// requests a pipeline sends before it stops to read their responses
+#define HTTP_PIPELINE_DEPTH (16)
+
+/**
+ * Keep-alive connections to one host, shared by every HttpClient that
+ * talks to it. Connections come back to the pool when a client is done
+ * with them and the server left them open.
+ */
+class HttpConnectionPool {
+ public:
+  /**
+   * The process-wide pool for host:port, created on first use.
+   */
+  static HttpConnectionPool *forHost(const std::string &host, int port, bool use_tls=false);
+
+  /**
+   * An idle connection if there is one, otherwise a new one. Sets
+   * *reused so callers know the server may have closed it meanwhile.
+   */
+  MySocket *acquire(bool *reused);
+
+  /**
+   * Hands back a connection that can carry another request. Beyond
+   * max_idle connections it is closed instead.
+   */
+  void release(MySocket *connection);
+  void setMaxIdle(size_t max_idle);
+
+ private:
+  HttpConnectionPool(const std::string &host, int port, bool use_tls);
+
+  std::string host;
+  int port;
+  bool use_tls;
+  size_t max_idle;
+  std::vector<MySocket *> idle;
+  std::mutex lock;
+};
+
+/**
+ * One request of a pipeline.
+ */
+struct HttpClientRequest {
+  std::string method;
+  std::string path;
+  std::string body;
+};
+
 class HttpClient {
  public:
   /**
@@ -14,9 +66,14 @@ class HttpClient {
    *
    * The constructor accepts a string representation of and ip address
    * ("192.168.0.1") or domain name ("www.cs.udavis.edu") and
-   * connects.  Will throw an HostNotFound exception if the attepted
+   * connects, reusing an idle connection to the same host if the pool
+   * has one.  Will throw an HostNotFound exception if the attepted
    * connection fails.
    *
+   * Connections are kept alive between requests unless the server
+   * closes them or the "Connection: close" header is set, and go back
+   * to the pool when the client is deleted.
+   *
    * Note: this call will block while establishing a connection.
    *
    * @param inetAddr either ip address, or the domain name
@@ -93,13 +150,46 @@ class HttpClient {
    * @param value the value for the header with key
    */
   void set_header(std::string key, std::string value);
-  
-  void write_request(std::string path, std::string method, std::string body);
+
+  /**
+   * HTTP request pipelining
+   *
+   * Sends the requests back to back on one connection, up to
+   * HTTP_PIPELINE_DEPTH at a time, without waiting for each response
+   * before sending the next. If the server closes the connection part
+   * way, the requests it didn't answer are sent again on a new one, so
+   * only pipeline requests that are safe to repeat. Once a response
+   * ends its connection the rest go one per connection, since a server
+   * that does that would only have the rest of a batch sent again.
+   *
+   * @param requests the requests, in the order they are sent
+   * @return one response per request, in the same order
+   */
+  std::vector<HTTPClientResponse *> pipeline(const std::vector<HttpClientRequest> &requests);
+
+  void write_request(const std::string &path, const std::string &method, const std::string &body);
   HTTPClientResponse *read_response();
   
  private:
+  void connect();
+  void disconnect();
+  void format_request(const std::string &path, const std::string &method, size_t body_size);
+  HTTPClientResponse *send(const std::string &method, const std::string &path, const std::string &body);
+  HTTPClientResponse *receive(bool head_request, bool *nothing_received);
+
+  HttpConnectionPool *pool;
   MySocket *connection;
+  // the connection came from the pool rather than being opened for us
+  bool reused;
   std::map<std::string, std::string> headers;
+  // request line and headers, formatted into the same buffer every time
+  std::string request;
+  // bytes read past the end of the last response
+  std::string pending;
+  // whether the last request written was a HEAD
+  bool head_request;
+  // requests written whose responses haven't been read
+  int outstanding;
 };
   
 
@@ -4,6 +4,9 @@
 #include <stdexcept>
 #include <string>
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 class SocketNotConnected : public std::runtime_error {
  public:
   SocketNotConnected() : std::runtime_error("socket not connected") {}
@@ -19,20 +22,30 @@ class SocketReadError : public std::runtime_error {
   SocketReadError() : std::runtime_error("socket read error") {}
 };
 
+class SocketTimeout : public std::runtime_error {
+ public:
+  SocketTimeout() : std::runtime_error("socket timed out") {}
+};
+
 class SocketError : public std::runtime_error {
  public:
   SocketError(std::string err) : std::runtime_error("socket error: " + err) {}
 };
 
+// an address of the form unix:/path/to/socket connects to a unix domain socket
+#define UNIX_SOCKET_PREFIX "unix:"
+
 class MySocket {
  public:
   /*
    * this is the constructor.  It accepts a string representation of
    * and ip address ("192.168.0.1") or domain name ("www.cs.uiuc.edu")
    * and connects.  Will throw an HostNotFound exception if the attepted
-   * connection fails.  MySocket uses the TCP protocol.
+   * connection fails.  MySocket uses the TCP protocol, or a unix
+   * domain socket when inetAddr is "unix:" followed by the socket's
+   * path, in which case port is ignored.
    *
-   * @param inetAddr either ip address, or the domain name
+   * @param inetAddr either ip address, or the domain name, or unix:path
    * @param port the port to connect to
    */
   MySocket(const char *inetAddr, int port);
@@ -49,14 +62,57 @@ class MySocket {
   virtual ~MySocket(void);
 
 
-  virtual std::string read();
+  /*
+   * reads whatever is available, up to size bytes, into buffer and
+   * returns how many bytes that was. Throws SocketReadError when the
+   * connection is closed or fails.
+   */
+  virtual size_t read(void *buffer, size_t size);
+
+  /*
+   * the same as read(buffer, size) into a new string of at most 4 KB,
+   * for callers that don't manage their own buffer.
+   */
+  std::string read();
   virtual void write(std::string data);
+
+  /*
+   * writes all of the buffers described by iov, in order, using as few
+   * system calls as possible.
+   */
+  virtual void writev(const struct iovec *iov, int iovcnt);
+
+  /*
+   * sends count bytes of the open file fileFd, starting at offset,
+   * directly to the socket without copying them through user space.
+   */
+  virtual void sendfile(int fileFd, off_t offset, size_t count);
   virtual void close(void);
+
+  /*
+   * stops sending, the peer reads end of file once it has everything
+   * already written. Reads keep working until close().
+   */
+  void shutdownWrite(void);
+
+  /*
+   * bounds how long reads (or writes) may keep waiting, in total, from
+   * now on. Once the deadline passes they throw SocketTimeout. Zero
+   * removes the deadline. The first deadline switches the socket to
+   * non-blocking mode so that a single large write can't outlive it.
+   */
+  void setReadDeadline(int milliseconds);
+  void setWriteDeadline(int milliseconds);
   
  protected:
   void call_connect(const char *inetAddr, int port);
+  void call_connect_unix(const char *path);
   void write_bytes(const void *buffer, int len);
+  void waitFor(short events, long long deadline);
   int sockFd;
+  bool nonBlocking;
+  long long readDeadline;
+  long long writeDeadline;
 };
 
 #endif
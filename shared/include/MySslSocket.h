@@ -19,8 +19,11 @@ class MySslSocket: public MySocket {
    */
   MySslSocket(const char *inetAddr, int port, bool debug_print_io=false);
 
-  std::string read();
+  using MySocket::read;
+  size_t read(void *buffer, size_t size);
   void write(std::string data);
+  void writev(const struct iovec *iov, int iovcnt);
+  void sendfile(int fileFd, off_t offset, size_t count);
   void close(void);
   
  protected:
@@ -19,6 +19,13 @@ void testWriteFile(LocalFileSystem &lfs, int parentInode, const string &name, co
 void testReadFile(LocalFileSystem &lfs, int parentInode, const string &name);
 void testUnlinkFile(LocalFileSystem &lfs, int parentInode, const string &name);
 void testUnlinkDir(LocalFileSystem &lfs, int parentInode, const string &name);
+void testPartialInodeRegion(const char *image);
+void testRename(LocalFileSystem &lfs);
+void testCopyUnlink(LocalFileSystem &lfs);
+void testSnapshot(LocalFileSystem &lfs);
+void testDeduplicate(const char *image);
+void testStagedWrite(LocalFileSystem &lfs);
+int usedDataBlocks(LocalFileSystem &lfs);
 void runUtility(const char *utility, const char *arg1 = nullptr, const char *arg2 = nullptr);
 
 int main() {
@@ -40,6 +47,26 @@ int main() {
     runUtility("./ds3ls", "disk.img");
     runUtility("./ds3bits", "disk.img");
 
+    cout << "Step 2: Filling an image whose last inode block is only partly used..." << endl;
+    testPartialInodeRegion("partial.img");
+
+    cout << "Step 3: Renaming files and directories..." << endl;
+    testRename(lfs);
+    runUtility("./ds3ls", "disk.img");
+
+    cout << "Step 4: Unlinking the original of a copy, then the copy..." << endl;
+    testCopyUnlink(lfs);
+    runUtility("./ds3bits", "disk.img");
+
+    cout << "Step 5: Taking a snapshot, reading it back and removing it..." << endl;
+    testSnapshot(lfs);
+
+    cout << "Step 6: Deduplicating identical blocks, across a reopen of the image..." << endl;
+    testDeduplicate("dedup.img");
+
+    cout << "Step 7: Staging a write's blocks, abandoning one write and committing another..." << endl;
+    testStagedWrite(lfs);
+
     // Uncomment the following steps to run them
 //    // Step 2: Confirm bitmap state
 //    cout << "Step 2: Confirming bitmap state..." << endl;
@@ -144,6 +171,199 @@ void testUnlinkDir(LocalFileSystem &lfs, int parentInode, const string &name) {
     cout << "Directory '" << name << "' unlinked successfully" << endl;
 }
 
+void testPartialInodeRegion(const char *image) {
+    // 40 inodes leave the second inode block partly used, which the inode region buffer has to cover
+    string command = string("./mkfs -f ") + image + " -i 40 -d 64";
+    system(command.c_str());
+    vector<string> names;
+    {
+        Disk disk(image, UFS_BLOCK_SIZE);
+        LocalFileSystem lfs(&disk);
+        super_t super;
+        lfs.readSuperBlock(&super);
+        assert(super.num_inodes % (UFS_BLOCK_SIZE / sizeof(inode_t)) != 0);
+        for (int i = 0; ; i++) {
+            string name = "f" + to_string(i);
+            int result = lfs.create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, name);
+            if (result < 0) {
+                assert(result == -ENOTENOUGHSPACE);
+                break;
+            }
+            names.push_back(name);
+        }
+        assert((int)names.size() == super.num_inodes - 1);
+    }
+
+    // Reopen the image and check every entry survived the round trip through the inode region
+    Disk disk(image, UFS_BLOCK_SIZE);
+    LocalFileSystem lfs(&disk);
+    for (size_t i = 0; i < names.size(); i++) {
+        assert(lfs.lookup(UFS_ROOT_DIRECTORY_INODE_NUMBER, names[i]) > 0);
+    }
+    cout << "Created and found " << names.size() << " files in '" << image << "'" << endl;
+    runUtility("./ds3bits", image);
+    unlink(image);
+}
+
+void testRename(LocalFileSystem &lfs) {
+    int root = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    testCreateDir(lfs, root, "from");
+    testCreateDir(lfs, root, "to");
+    int from = lfs.lookup(root, "from"), to = lfs.lookup(root, "to");
+    testCreateFile(lfs, from, "a.txt");
+    testWriteFile(lfs, from, "a.txt", "renamed data");
+    int file = lfs.lookup(from, "a.txt");
+
+    // Within a directory the entry changes name and keeps its inode
+    assert(lfs.rename(from, "a.txt", from, "b.txt") == 0);
+    assert(lfs.lookup(from, "a.txt") == -ENOTFOUND && lfs.lookup(from, "b.txt") == file);
+
+    // Across directories
+    assert(lfs.rename(from, "b.txt", to, "b.txt") == 0);
+    assert(lfs.lookup(from, "b.txt") == -ENOTFOUND && lfs.lookup(to, "b.txt") == file);
+    testReadFile(lfs, to, "b.txt");
+
+    // Onto an existing file, which goes away
+    testCreateFile(lfs, to, "c.txt");
+    testWriteFile(lfs, to, "c.txt", "replaced");
+    assert(lfs.rename(to, "b.txt", to, "c.txt") == 0);
+    assert(lfs.lookup(to, "b.txt") == -ENOTFOUND && lfs.lookup(to, "c.txt") == file);
+    char buffer[64] = {0};
+    assert(lfs.read(file, buffer, sizeof(buffer)) == (int)strlen("renamed data") && strcmp(buffer, "renamed data") == 0);
+
+    // A directory can't go inside itself
+    testCreateDir(lfs, from, "inner");
+    assert(lfs.rename(root, "from", lfs.lookup(from, "inner"), "from") == -EINVALIDMOVE);
+    assert(lfs.lookup(root, "from") == from);
+    cout << "Renames within and across directories, over a file and into a subtree behaved" << endl;
+}
+
+void testCopyUnlink(LocalFileSystem &lfs) {
+    int root = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    string data(3 * UFS_BLOCK_SIZE - 100, 'c');
+    testCreateFile(lfs, root, "orig");
+    testCreateFile(lfs, root, "dup");
+    int orig = lfs.lookup(root, "orig"), dup = lfs.lookup(root, "dup");
+    assert(lfs.write(orig, data.data(), data.size()) == (int)data.size());
+
+    // The copy shares the original's three blocks
+    int before = usedDataBlocks(lfs);
+    assert(lfs.copy(orig, dup) == (int)data.size());
+    assert(usedDataBlocks(lfs) == before);
+
+    // Unlinking the original leaves the blocks to the copy, unlinking the copy frees them
+    testUnlinkFile(lfs, root, "orig");
+    assert(usedDataBlocks(lfs) == before);
+    string buffer(data.size(), '\0');
+    assert(lfs.read(dup, &buffer[0], buffer.size()) == (int)data.size() && buffer == data);
+    testUnlinkFile(lfs, root, "dup");
+    assert(usedDataBlocks(lfs) == before - 3);
+    cout << "Shared blocks stayed in use until the last file let go of them" << endl;
+}
+
+void testSnapshot(LocalFileSystem &lfs) {
+    int root = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    testCreateFile(lfs, root, "kept.txt");
+    testWriteFile(lfs, root, "kept.txt", "before the snapshot");
+    int before = usedDataBlocks(lfs);
+
+    // The snapshot holds the file as it was, whatever happens to the live one
+    int snapshot = lfs.snapshot("s1");
+    assert(snapshot >= 0 && lfs.snapshot("s1") == -ESNAPSHOTEXISTS);
+    assert(lfs.lookup(lfs.lookup(snapshot, "from"), "inner") >= 0);
+    testWriteFile(lfs, root, "kept.txt", "after the snapshot");
+    testReadFile(lfs, snapshot, "kept.txt");
+    char buffer[64] = {0};
+    assert(lfs.read(lfs.lookup(snapshot, "kept.txt"), buffer, sizeof(buffer)) == (int)strlen("before the snapshot"));
+    assert(strcmp(buffer, "before the snapshot") == 0);
+
+    // Removing it frees its directories and the old contents only it still held, the first snapshot
+    // created /.snapshots and that stays with its one block
+    assert(lfs.removeSnapshot("s1") == 0);
+    assert(lfs.lookup(lfs.lookup(root, SNAPSHOT_DIRECTORY), "s1") == -ENOTFOUND);
+    assert(usedDataBlocks(lfs) == before + 1);
+    testReadFile(lfs, root, "kept.txt");
+    cout << "The snapshot kept the old contents and gave its blocks back when removed" << endl;
+}
+
+void testDeduplicate(const char *image) {
+    int root = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    string command = string("./mkfs -f ") + image + " -i 64 -d 64";
+    system(command.c_str());
+
+    // Two identical blocks and a partial one, so a file needs two distinct blocks
+    string data = string(2 * UFS_BLOCK_SIZE, 'x') + string(100, 'z');
+    int used;
+    {
+        Disk disk(image, UFS_BLOCK_SIZE);
+        LocalFileSystem lfs(&disk); lfs.setDeduplicate(true);
+        used = usedDataBlocks(lfs);
+        testCreateFile(lfs, root, "a");
+        assert(lfs.write(lfs.lookup(root, "a"), data.data(), data.size()) == (int)data.size());
+        assert(usedDataBlocks(lfs) == used + 2);
+        testCreateFile(lfs, root, "b");
+        assert(lfs.write(lfs.lookup(root, "b"), data.data(), data.size()) == (int)data.size());
+        assert(usedDataBlocks(lfs) == used + 2);
+    }
+
+    // A fresh LocalFileSystem rebuilds the index from the blocks on disk
+    Disk disk(image, UFS_BLOCK_SIZE);
+    LocalFileSystem lfs(&disk); lfs.setDeduplicate(true);
+    testCreateFile(lfs, root, "c");
+    int c = lfs.lookup(root, "c");
+    assert(lfs.write(c, data.data(), data.size()) == (int)data.size());
+    assert(usedDataBlocks(lfs) == used + 2);
+    string buffer(data.size(), '\0');
+    assert(lfs.read(c, &buffer[0], buffer.size()) == (int)data.size() && buffer == data);
+
+    // The blocks are only freed along with the last file
+    testUnlinkFile(lfs, root, "a");
+    testUnlinkFile(lfs, root, "b");
+    assert(usedDataBlocks(lfs) == used + 2);
+    testUnlinkFile(lfs, root, "c");
+    assert(usedDataBlocks(lfs) == used);
+    cout << "Three copies of a three block file shared two blocks" << endl;
+    unlink(image);
+}
+
+void testStagedWrite(LocalFileSystem &lfs) {
+    int root = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    string data(3 * UFS_BLOCK_SIZE - 100, 's');
+    int before = usedDataBlocks(lfs);
+
+    // Staged blocks are in use as soon as they're set aside, and free again once the write is abandoned
+    {
+        WriteStream stream;
+        assert(lfs.stageWrite(data.size(), &stream) == 0);
+        assert(usedDataBlocks(lfs) == before + 3);
+        assert(lfs.appendWrite(&stream, data.data(), UFS_BLOCK_SIZE) == 0);
+        lfs.abortWrite(&stream);
+        assert(usedDataBlocks(lfs) == before);
+    }
+
+    // The file only gets pointed at the blocks once the write is committed
+    WriteStream stream;
+    assert(lfs.stageWrite(data.size(), &stream) == 0);
+    assert(lfs.appendWrite(&stream, data.data(), data.size()) == 0);
+    testCreateFile(lfs, root, "staged");
+    int inode = lfs.lookup(root, "staged");
+    assert(lfs.commitWrite(inode, &stream) == (int)data.size());
+    assert(usedDataBlocks(lfs) == before + 3);
+    string buffer(data.size(), '\0');
+    assert(lfs.read(inode, &buffer[0], buffer.size()) == (int)data.size() && buffer == data);
+    testUnlinkFile(lfs, root, "staged");
+    assert(usedDataBlocks(lfs) == before);
+    cout << "Staged blocks were given back or handed to the file" << endl;
+}
+
+int usedDataBlocks(LocalFileSystem &lfs) {
+    super_t super; lfs.readSuperBlock(&super);
+    vector<unsigned char> bitmap(super.data_bitmap_len * UFS_BLOCK_SIZE); lfs.readDataBitmap(&super, bitmap.data());
+    int used = 0;
+    for (int i = 0; i < super.num_data; i++) { if ((bitmap[i / 8] >> (i % 8)) & 1) { used++; } }
+    return used;
+}
+
 void runUtility(const char *utility, const char *arg1, const char *arg2) {
     cout << "Running utility: " << utility;
     if (arg1) cout << " " << arg1;